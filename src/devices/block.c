@@ -1,9 +1,18 @@
 #include "devices/block.h"
 #include <list.h>
+#include <round.h>
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/** Most sectors in a request made by merging others. */
+#define MERGE_MAX 64
+#define MERGE_PAGES DIV_ROUND_UP (MERGE_MAX * BLOCK_SECTOR_SIZE, PGSIZE)
 
 /** A block device. */
 struct block
@@ -17,8 +26,17 @@ struct block
     const struct block_operations *ops;  /**< Driver operations. */
     void *aux;                          /**< Extra data owned by driver. */
 
+    /* Request queue, unless OPS->submit is set. */
+    struct list queue;                  /**< Pending requests, by sector. */
+    struct lock queue_lock;             /**< Protects the members above. */
+    struct condition queue_cond;        /**< Signaled when QUEUE grows. */
+    block_sector_t head;                /**< Sector after last request. */
+    uint8_t *merge_buf;                 /**< Data of merged requests. */
+
     unsigned long long read_cnt;        /**< Number of sectors read. */
     unsigned long long write_cnt;       /**< Number of sectors written. */
+    unsigned long long request_cnt;     /**< Number of driver requests. */
+    unsigned long long merge_cnt;       /**< Requests merged into others. */
   };
 
 /** List of all block devices. */
@@ -28,6 +46,7 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static thread_func dispatcher NO_RETURN;
 
 /** Returns a human-readable name for the given block device
    TYPE. */
@@ -99,12 +118,12 @@ block_get_by_name (const char *name)
   return NULL;
 }
 
-/** Verifies that SECTOR is a valid offset within BLOCK.
-   Panics if not. */
+/** Verifies that the CNT sectors starting at SECTOR are valid
+   offsets within BLOCK.  Panics if not. */
 static void
-check_sector (struct block *block, block_sector_t sector)
+check_sector (struct block *block, block_sector_t sector, size_t cnt)
 {
-  if (sector >= block->size)
+  if (sector >= block->size || cnt > block->size - sector)
     {
       /* We do not use ASSERT because we want to panic here
          regardless of whether NDEBUG is defined. */
@@ -113,6 +132,70 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/** Returns true if request A_ starts before request B_. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+
+  return a->sector < b->sector;
+}
+
+/** Submits REQ to BLOCK and returns without waiting for it to be
+   carried out.  REQ->done will be called when it has been. */
+void
+block_submit (struct block *block, struct block_request *req)
+{
+  ASSERT (req->cnt > 0);
+  ASSERT (!req->write || block->type != BLOCK_FOREIGN);
+  check_sector (block, req->sector, req->cnt);
+
+  lock_acquire (&block->queue_lock);
+  if (req->write)
+    block->write_cnt += req->cnt;
+  else
+    block->read_cnt += req->cnt;
+  if (block->ops->submit == NULL)
+    {
+      list_insert_ordered (&block->queue, &req->elem, request_less, NULL);
+      cond_signal (&block->queue_cond, &block->queue_lock);
+    }
+  lock_release (&block->queue_lock);
+
+  if (block->ops->submit != NULL)
+    block->ops->submit (block->aux, req);
+}
+
+/** Completion function for block_transfer(). */
+static void
+wake_submitter (struct block_request *req)
+{
+  sema_up (req->aux);
+}
+
+/** Transfers CNT sectors starting at SECTOR between BLOCK and
+   BUFFER, writing BUFFER if WRITE is true and reading into it
+   otherwise, and waits for the transfer to complete. */
+static void
+block_transfer (struct block *block, block_sector_t sector, size_t cnt,
+                void *buffer, bool write)
+{
+  struct block_request req;
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  req.sector = sector;
+  req.cnt = cnt;
+  req.buffer = buffer;
+  req.write = write;
+  req.done = wake_submitter;
+  req.aux = &done;
+  block_submit (block, &req);
+  sema_down (&done);
+}
+
 /** Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +203,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_transfer (block, sector, 1, buffer, false);
 }
 
 /** Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +214,30 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_transfer (block, sector, 1, (void *) buffer, true);
+}
+
+/** Reads CNT sectors starting at SECTOR from BLOCK into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  If
+   the driver supports it, this takes a single request rather
+   than one per sector. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  block_transfer (block, sector, cnt, buffer, false);
+}
+
+/** Writes CNT sectors starting at SECTOR to BLOCK from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes.  Returns
+   after the block device has acknowledged receiving the data.
+   If the driver supports it, this takes a single request rather
+   than one per sector. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  block_transfer (block, sector, cnt, (void *) buffer, true);
 }
 
 /** Returns the number of sectors in BLOCK. */
@@ -171,9 +272,11 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          printf ("%s (%s): %llu reads, %llu writes, %llu requests, "
+                  "%llu merged\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->read_cnt, block->write_cnt, block->request_cnt,
+                  block->merge_cnt);
         }
     }
 }
@@ -198,8 +301,15 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
+  list_init (&block->queue);
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_cond);
+  block->head = 0;
+  block->merge_buf = NULL;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->request_cnt = 0;
+  block->merge_cnt = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -208,6 +318,13 @@ block_register (const char *name, enum block_type type,
     printf (", %s", extra_info);
   printf ("\n");
 
+  /* The dispatcher thread is named after the device. */
+  if (ops->submit == NULL)
+    {
+      block->merge_buf = palloc_get_multiple (PAL_ASSERT, MERGE_PAGES);
+      thread_create (block->name, PRI_DEFAULT, dispatcher, block);
+    }
+
   return block;
 }
 
@@ -221,3 +338,141 @@ list_elem_to_block (struct list_elem *list_elem)
           : NULL);
 }
 
+/** Carries out a request to transfer CNT sectors starting at
+   SECTOR between BLOCK and BUFFER, with a single call to the
+   driver if it supports that. */
+static void
+block_dispatch (struct block *block, block_sector_t sector, size_t cnt,
+                void *buffer, bool write)
+{
+  uint8_t *p = buffer;
+  size_t i;
+
+  if (write && block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, cnt, buffer);
+  else if (!write && block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    {
+      for (i = 0; i < cnt; i++)
+        if (write)
+          block->ops->write (block->aux, sector + i,
+                             p + i * BLOCK_SECTOR_SIZE);
+        else
+          block->ops->read (block->aux, sector + i,
+                            p + i * BLOCK_SECTOR_SIZE);
+      block->request_cnt += cnt - 1;
+    }
+  block->request_cnt++;
+}
+
+/** Moves the next request to carry out from BLOCK's queue into
+   BATCH, followed by the requests that continue it on disk in the
+   same direction, up to MERGE_MAX sectors in all.  Returns the
+   number of sectors in BATCH.  The caller must hold BLOCK's
+   queue_lock.
+
+   Requests are served in C-LOOK order: the head sweeps toward
+   higher sectors, serving the lowest request at or past where it
+   is, then jumps back to the lowest request of all once it has
+   passed every one. */
+static size_t
+take_requests (struct block *block, struct list *batch)
+{
+  struct block_request *first;
+  struct list_elem *e;
+  size_t cnt;
+
+  ASSERT (!list_empty (&block->queue));
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    if (list_entry (e, struct block_request, elem)->sector >= block->head)
+      break;
+  if (e == list_end (&block->queue))
+    e = list_begin (&block->queue);
+
+  first = list_entry (e, struct block_request, elem);
+  cnt = first->cnt;
+  e = list_remove (e);
+  list_push_back (batch, &first->elem);
+
+  while (e != list_end (&block->queue))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+
+      if (r->write != first->write || r->sector != first->sector + cnt
+          || cnt + r->cnt > MERGE_MAX)
+        break;
+      cnt += r->cnt;
+      e = list_remove (e);
+      list_push_back (batch, &r->elem);
+      block->merge_cnt++;
+    }
+
+  block->head = first->sector + cnt;
+  return cnt;
+}
+
+/** Dispatcher thread for BLOCK_.  Carries out queued requests,
+   merged where possible, and reports their completion. */
+static void
+dispatcher (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct block_request *first;
+      struct list batch;
+      struct list_elem *e;
+      size_t cnt;
+
+      list_init (&batch);
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->queue))
+        cond_wait (&block->queue_cond, &block->queue_lock);
+      cnt = take_requests (block, &batch);
+      lock_release (&block->queue_lock);
+
+      first = list_entry (list_front (&batch), struct block_request, elem);
+      if (list_size (&batch) == 1)
+        block_dispatch (block, first->sector, cnt, first->buffer,
+                        first->write);
+      else
+        {
+          /* Merged requests go through MERGE_BUF, since their
+             buffers are not contiguous. */
+          uint8_t *p = block->merge_buf;
+
+          if (first->write)
+            for (e = list_begin (&batch); e != list_end (&batch);
+                 e = list_next (e))
+              {
+                struct block_request *r
+                  = list_entry (e, struct block_request, elem);
+                memcpy (p, r->buffer, r->cnt * BLOCK_SECTOR_SIZE);
+                p += r->cnt * BLOCK_SECTOR_SIZE;
+              }
+          block_dispatch (block, first->sector, cnt, block->merge_buf,
+                          first->write);
+          if (!first->write)
+            for (e = list_begin (&batch); e != list_end (&batch);
+                 e = list_next (e))
+              {
+                struct block_request *r
+                  = list_entry (e, struct block_request, elem);
+                memcpy (r->buffer, p, r->cnt * BLOCK_SECTOR_SIZE);
+                p += r->cnt * BLOCK_SECTOR_SIZE;
+              }
+        }
+
+      /* A request may be freed as soon as its DONE is called. */
+      while (!list_empty (&batch))
+        {
+          struct block_request *r
+            = list_entry (list_pop_front (&batch), struct block_request, elem);
+          r->done (r);
+        }
+    }
+}
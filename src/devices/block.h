@@ -1,6 +1,8 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
 
@@ -49,10 +51,34 @@ struct block *block_get_by_name (const char *name);
 struct block *block_first (void);
 struct block *block_next (struct block *);
 
+/** An asynchronous request to read or write CNT consecutive
+   sectors starting at SECTOR.  The submitter fills in every
+   member but ELEM, then must leave the request and its BUFFER
+   alone until the block layer calls DONE.  DONE is called from
+   the device's dispatcher thread or, for a device that queues
+   requests itself, from its interrupt handler, so it must not
+   sleep.
+   Requests that overlap may be carried out in either order. */
+struct block_request
+  {
+    block_sector_t sector;      /**< First sector. */
+    size_t cnt;                 /**< Number of sectors. */
+    void *buffer;               /**< CNT * BLOCK_SECTOR_SIZE bytes. */
+    bool write;                 /**< Write BUFFER, rather than read into it? */
+    void (*done) (struct block_request *); /**< Called when complete. */
+    void *aux;                  /**< For DONE's use. */
+    struct list_elem elem;      /**< Used by the block layer or driver. */
+  };
+
 /** Block device operations. */
+void block_submit (struct block *, struct block_request *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -61,10 +87,29 @@ void block_print_stats (void);
 
 /** Lower-level interface to block device drivers. */
 
+/** READ_MULTIPLE and WRITE_MULTIPLE transfer CNT consecutive
+   sectors in as few requests as the device allows.  A driver may
+   leave them null, in which case the block layer transfers one
+   sector at a time.
+
+   The block layer queues requests for each device and calls the
+   driver from a dispatcher thread, one request at a time.  A
+   device that is a view of other devices instead sets SUBMIT,
+   which is handed each request as it is submitted, typically to
+   remap it onto another device's queue.  So does the driver of
+   a device with its own queue, which takes many requests at
+   once, or of one that can carry out a request at once, calling
+   DONE before it returns.  Such a device needs no other
+   operations. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
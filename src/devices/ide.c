@@ -5,13 +5,18 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /** The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].  If the
+   controller is a PCI bus master, data moves by DMA, so that
+   other threads run during a transfer; otherwise, or if DMA
+   fails, it moves by PIO. */
 
 /** ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /**< Data. */
@@ -30,10 +35,25 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /**< Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /**< Alt Status (r/o). */
 
+/** Bus master port addresses, for channels whose controller is a
+   PCI bus master. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /**< Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /**< Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /**< PRD table. */
+
+/** Bus master command register bits. */
+#define BM_CMD_START 0x01       /**< Start transfer. */
+#define BM_CMD_READ 0x08        /**< Transfer from disk to memory. */
+
+/** Bus master status register bits.  Writing 1 clears them. */
+#define BM_STA_ERR 0x02         /**< Transfer failed. */
+#define BM_STA_IRQ 0x04         /**< Disk raised its interrupt. */
+
 /** Alternate Status Register bits. */
 #define STA_BSY 0x80            /**< Busy. */
 #define STA_DRDY 0x40           /**< Device Ready. */
 #define STA_DRQ 0x08            /**< Data Request. */
+#define STA_ERR 0x01            /**< Error. */
 
 /** Control Register bits. */
 #define CTL_SRST 0x04           /**< Software Reset. */
@@ -49,6 +69,14 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /**< IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /**< READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /**< WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /**< READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /**< WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /**< SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /**< READ DMA. */
+#define CMD_WRITE_DMA 0xca              /**< WRITE DMA. */
+
+/** Most sectors a single READ or WRITE command can transfer. */
+#define MAX_SECTORS 256
 
 /** An ATA device. */
 struct ata_disk
@@ -57,7 +85,24 @@ struct ata_disk
     struct channel *channel;    /**< Channel that disk is attached to. */
     int dev_no;                 /**< Device 0 or 1 for master or slave. */
     bool is_ata;                /**< Is device an ATA disk? */
+    int multiple;               /**< Sectors per interrupt under READ and
+                                   WRITE MULTIPLE, or 0 if unsupported. */
+    bool dma;                   /**< Transfer data by DMA? */
+  };
+
+/** A physical region descriptor, one piece of memory in a DMA
+   transfer.  A region may not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /**< Physical address. */
+    uint16_t size;              /**< Size in bytes, or 0 for 64 kB. */
+    uint16_t flags;             /**< PRD_EOT on the last region. */
   };
+#define PRD_EOT 0x8000
+
+/** Regions in a channel's PRD table.  A transfer of MAX_SECTORS
+   sectors spans at most three 64 kB blocks of memory. */
+#define PRD_CNT 8
 
 /** An ATA channel (aka controller).
    Each channel can control up to two disks. */
@@ -66,6 +111,8 @@ struct channel
     char name[8];               /**< Name, e.g. "ide0". */
     uint16_t reg_base;          /**< Base I/O port. */
     uint8_t irq;                /**< Interrupt in use. */
+    uint16_t bm_base;           /**< Bus master I/O base, or 0 if none. */
+    struct prd *prdt;           /**< PRD table, if BM_BASE is nonzero. */
 
     struct lock lock;           /**< Must acquire to access the controller. */
     bool expecting_interrupt;   /**< True if an interrupt is expected, false if
@@ -79,16 +126,24 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/** PRD table for each channel.  The controller requires each
+   table to be 4-byte aligned and not to cross a 64 kB boundary;
+   aligning it to its own size does both. */
+static struct prd prdts[CHANNEL_CNT][PRD_CNT]
+  __attribute__ ((aligned (PRD_CNT * sizeof (struct prd))));
+
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
+static void set_multiple_mode (struct ata_disk *, int cnt);
 
-static void select_sector (struct ata_disk *, block_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
-static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
+static void issue_command (struct channel *, uint8_t command);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -101,6 +156,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,6 +179,11 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
+      if (bm_base != 0)
+        {
+          c->bm_base = bm_base + chan_no * 8;
+          c->prdt = prdts[chan_no];
+        }
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
@@ -136,6 +197,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -157,6 +220,37 @@ ide_init (void)
 
 /** Disk detection and identification. */
 
+/** Looks for a PCI IDE controller that drives the legacy channels
+   and can act as a bus master.  Returns the base of its bus
+   master ports, the primary channel's followed by the
+   secondary's, or 0 if there is no such controller. */
+static uint16_t
+find_bus_master (void) 
+{
+  struct pci_dev dev;
+  uint8_t prog_if;
+  uint32_t bar;
+
+  if (!pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &dev))
+    return 0;
+
+  /* Bits 0 and 2 of the programming interface are set for
+     channels in native mode, which use other ports and
+     interrupts than ours.  Bit 7 is set if the controller can be
+     a bus master. */
+  prog_if = pci_read_config (&dev, PCI_REG_CLASS) >> 8;
+  if ((prog_if & 0x85) != 0x80)
+    return 0;
+
+  /* The bus master ports are in I/O space, at BAR 4. */
+  bar = pci_read_config (&dev, PCI_REG_BAR (4));
+  if (!(bar & 1) || (bar & ~3u) == 0)
+    return 0;
+
+  pci_enable_bus_master (&dev);
+  return bar & ~3u;
+}
+
 static char *descramble_ata_string (char *, int size);
 
 /** Resets an ATA channel and waits for any devices present on it
@@ -272,22 +366,24 @@ identify_ata_device (struct ata_disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
       d->is_ata = false;
       return;
     }
-  input_sector (c, id);
+  input_sectors (c, id, 1);
 
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x0100);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            d->dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -303,12 +399,36 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Transfer as many sectors per interrupt as the disk allows. */
+  set_multiple_mode (d, *(uint16_t *) &id[47 * 2] & 0xff);
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/** Sets disk D to transfer CNT sectors per interrupt under READ
+   and WRITE MULTIPLE, and records whether it accepted.  A CNT of
+   0 means that D does not support those commands. */
+static void
+set_multiple_mode (struct ata_disk *d, int cnt) 
+{
+  struct channel *c = d->channel;
+
+  d->multiple = 0;
+  if (cnt == 0)
+    return;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), cnt);
+  issue_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if (!(inb (reg_status (c)) & STA_ERR))
+    d->multiple = cnt;
+}
+
 /** Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +457,217 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/** Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/** Reads CNT sectors, at most MAX_SECTORS, starting at SEC_NO
+   from disk D into BUFFER by PIO.  The disk interrupts once per
+   D->multiple sectors, or once per sector if it does not support
+   READ MULTIPLE.  The caller must hold D's channel lock. */
+static void
+pio_read (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+          uint8_t *buffer)
+{
+  struct channel *c = d->channel;
+  size_t per_intr = d->multiple > 0 ? d->multiple : 1;
+  size_t i;
+
+  select_sector (d, sec_no, cnt);
+  issue_command (c, d->multiple > 0
+                 ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < cnt; i += per_intr)
+    {
+      size_t block_cnt = cnt - i < per_intr ? cnt - i : per_intr;
+
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no + i);
+      input_sectors (c, buffer + i * BLOCK_SECTOR_SIZE, block_cnt);
+    }
+}
+
+/** Writes CNT sectors, at most MAX_SECTORS, starting at SEC_NO
+   to disk D from BUFFER by PIO, with as few interrupts as
+   pio_read().  The caller must hold D's channel lock. */
+static void
+pio_write (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+           const uint8_t *buffer)
+{
+  struct channel *c = d->channel;
+  size_t per_intr = d->multiple > 0 ? d->multiple : 1;
+  size_t i;
+
+  select_sector (d, sec_no, cnt);
+  issue_command (c, d->multiple > 0
+                 ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+  for (i = 0; i < cnt; i += per_intr)
+    {
+      size_t block_cnt = cnt - i < per_intr ? cnt - i : per_intr;
+
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no + i);
+      output_sectors (c, buffer + i * BLOCK_SECTOR_SIZE, block_cnt);
+      sema_down (&c->completion_wait);
+    }
+}
+
+/** Fills in channel C's PRD table to describe the SIZE bytes at
+   BUFFER, which must be in kernel memory.  Kernel virtual memory
+   maps physical memory in order, so BUFFER is physically
+   contiguous; it only needs splitting at 64 kB boundaries. */
+static void
+build_prdt (struct channel *c, const void *buffer, size_t size) 
+{
+  uintptr_t addr = vtop (buffer);
+  size_t i = 0;
+
+  while (size > 0)
+    {
+      size_t region = 0x10000 - (addr & 0xffff);
+      if (region > size)
+        region = size;
+
+      ASSERT (i < PRD_CNT);
+      c->prdt[i].addr = addr;
+      c->prdt[i].size = region & 0xffff;
+      c->prdt[i].flags = 0;
+      i++;
+
+      addr += region;
+      size -= region;
+    }
+  c->prdt[i - 1].flags = PRD_EOT;
+}
+
+/** Transfers CNT sectors, at most MAX_SECTORS, starting at SEC_NO
+   between disk D and BUFFER by DMA: from the disk into BUFFER if
+   WRITE is false, from BUFFER to the disk if it is true.  The
+   calling thread sleeps until the transfer is done.  Returns true
+   if successful.  Otherwise turns off DMA for D and returns false,
+   so that the caller can fall back to PIO.  The caller must hold
+   D's channel lock. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              const void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  uint8_t bm_status, status;
+
+  build_prdt (c, buffer, cnt * BLOCK_SECTOR_SIZE);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BM_STA_ERR | BM_STA_IRQ);
+
+  select_sector (d, sec_no, cnt);
+  issue_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+  sema_down (&c->completion_wait);
+
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), bm_status | BM_STA_ERR | BM_STA_IRQ);
+  status = inb (reg_alt_status (c));
+  if ((bm_status & BM_STA_ERR) || (status & STA_ERR))
+    {
+      printf ("%s: DMA %s failed, sector=%"PRDSNu"; using PIO\n",
+              d->name, write ? "write" : "read", sec_no);
+      d->dma = false;
+      return false;
+    }
+  return true;
+}
+
+/** Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes, with
+   one command per MAX_SECTORS sectors.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt, void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  uint8_t *p = buffer;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_SECTORS ? cnt : MAX_SECTORS;
+
+      if (!d->dma || !dma_transfer (d, sec_no, n, p, false))
+        pio_read (d, sec_no, n, p);
+      sec_no += n;
+      cnt -= n;
+      p += n * BLOCK_SECTOR_SIZE;
+    }
   lock_release (&c->lock);
 }
 
-/** Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+/** Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes, with one
+   command per MAX_SECTORS sectors.  Returns after the disk has
    acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *p = buffer;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_SECTORS ? cnt : MAX_SECTORS;
+
+      if (!d->dma || !dma_transfer (d, sec_no, n, p, true))
+        pio_write (d, sec_no, n, p);
+      sec_no += n;
+      cnt -= n;
+      p += n * BLOCK_SECTOR_SIZE;
+    }
   lock_release (&c->lock);
 }
 
+/** Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multiple (d_, sec_no, 1, buffer);
+}
+
+/** Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, buffer);
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL
   };
 
 /** Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt == MAX_SECTORS ? 0 : cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -404,7 +678,7 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 /** Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
   /* Interrupts must be enabled or our semaphore will never be
      up'd by the completion handler. */
@@ -414,20 +688,22 @@ issue_pio_command (struct channel *c, uint8_t command)
   outb (reg_command (c), command);
 }
 
-/** Reads a sector from channel C's data register in PIO mode into
-   SECTOR, which must have room for BLOCK_SECTOR_SIZE bytes. */
+/** Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-input_sector (struct channel *c, void *sector) 
+input_sectors (struct channel *c, void *sectors, size_t cnt) 
 {
-  insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
-/** Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/** Writes CNT sectors from SECTORS to channel C's data register in
+   PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE
+   bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, size_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
 
 /** Low-level ATA primitives. */
@@ -0,0 +1,152 @@
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+
+/** The code in this file reads and writes PCI configuration space
+   through configuration mechanism #1, which every PC chipset
+   since the original PCI ones supports. */
+
+/** Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDR 0xcf8   /**< Selects bus, device, function, reg. */
+#define PCI_CONFIG_DATA 0xcfc   /**< Data at the selected register. */
+
+/** Command register bits. */
+#define PCI_CMD_BUS_MASTER 0x0004       /**< Allow bus mastering. */
+
+/** Header type bits. */
+#define PCI_HEADER_MULTI 0x80   /**< Device has more than one function. */
+
+/** Returns the value to write to PCI_CONFIG_ADDR to select
+   register REG of D. */
+static uint32_t
+config_addr (const struct pci_dev *d, int reg) 
+{
+  return (0x80000000 | ((uint32_t) d->bus << 16) | ((uint32_t) d->dev << 11)
+          | ((uint32_t) d->func << 8) | (reg & 0xfc));
+}
+
+/** Returns the 32-bit configuration register REG of D, which
+   must be a multiple of 4. */
+uint32_t
+pci_read_config (const struct pci_dev *d, int reg) 
+{
+  enum intr_level old_level = intr_disable ();
+  uint32_t value;
+
+  outl (PCI_CONFIG_ADDR, config_addr (d, reg));
+  value = inl (PCI_CONFIG_DATA);
+  intr_set_level (old_level);
+  return value;
+}
+
+/** Writes VALUE to the 32-bit configuration register REG of D,
+   which must be a multiple of 4. */
+void
+pci_write_config (const struct pci_dev *d, int reg, uint32_t value) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  outl (PCI_CONFIG_ADDR, config_addr (d, reg));
+  outl (PCI_CONFIG_DATA, value);
+  intr_set_level (old_level);
+}
+
+/** Scans every bus for PCI functions, calling MATCH on each with
+   AUX, in order, until it returns true.  If it does, stores the
+   function's location in *D and returns true; otherwise returns
+   false. */
+static bool
+find_function (bool (*match) (const struct pci_dev *, void *aux), void *aux,
+               struct pci_dev *d) 
+{
+  int bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          d->bus = bus;
+          d->dev = dev;
+          d->func = func;
+          if ((pci_read_config (d, PCI_REG_ID) & 0xffff) == 0xffff)
+            {
+              /* No such function.  If it's function 0, there's no
+                 such device either. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          if (match (d, aux))
+            return true;
+
+          if (func == 0
+              && !((pci_read_config (d, PCI_REG_HEADER) >> 16)
+                   & PCI_HEADER_MULTI))
+            break;
+        }
+  return false;
+}
+
+/** find_function() callback for pci_find_class(). */
+static bool
+match_class (const struct pci_dev *d, void *class_)
+{
+  const uint8_t *class = class_;
+  uint32_t reg = pci_read_config (d, PCI_REG_CLASS);
+
+  return (reg >> 24) == class[0] && ((reg >> 16) & 0xff) == class[1];
+}
+
+/** Looks for the first PCI function of the given CLASS and
+   SUBCLASS, scanning every bus.  If one is found, stores its
+   location in *D and returns true; otherwise returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *d) 
+{
+  uint8_t aux[2] = {class, subclass};
+
+  return find_function (match_class, aux, d);
+}
+
+/** Arguments to match_device(). */
+struct device_match
+  {
+    uint32_t id;                /**< Device ID 31:16, vendor ID 15:0. */
+    int skip;                   /**< Number of matches still to skip. */
+  };
+
+/** find_function() callback for pci_find_device(). */
+static bool
+match_device (const struct pci_dev *d, void *m_)
+{
+  struct device_match *m = m_;
+
+  return pci_read_config (d, PCI_REG_ID) == m->id && m->skip-- == 0;
+}
+
+/** Looks for PCI function number NTH, counting from 0, with the
+   given VENDOR and DEVICE IDs, scanning every bus.  If there is
+   one, stores its location in *D and returns true; otherwise
+   returns false. */
+bool
+pci_find_device (uint16_t vendor, uint16_t device, int nth,
+                 struct pci_dev *d) 
+{
+  struct device_match m;
+
+  m.id = ((uint32_t) device << 16) | vendor;
+  m.skip = nth;
+  return find_function (match_device, &m, d);
+}
+
+/** Allows D to initiate transfers on the bus, as it must to do
+   DMA. */
+void
+pci_enable_bus_master (const struct pci_dev *d) 
+{
+  /* Writing zeros to the status half of the register leaves it
+     alone, since its bits are cleared by writing ones. */
+  uint32_t command = pci_read_config (d, PCI_REG_COMMAND) & 0xffff;
+  pci_write_config (d, PCI_REG_COMMAND, command | PCI_CMD_BUS_MASTER);
+}
@@ -0,0 +1,34 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Location of a PCI function. */
+struct pci_dev
+  {
+    uint8_t bus;                /**< Bus number. */
+    uint8_t dev;                /**< Device number on the bus, 0...31. */
+    uint8_t func;               /**< Function number, 0...7. */
+  };
+
+/** Configuration space registers. */
+#define PCI_REG_ID 0x00         /**< Device ID 31:16, vendor ID 15:0. */
+#define PCI_REG_COMMAND 0x04    /**< Status 31:16, command 15:0. */
+#define PCI_REG_CLASS 0x08      /**< Class, subclass, prog IF, revision. */
+#define PCI_REG_HEADER 0x0c     /**< Header type in 23:16. */
+#define PCI_REG_BAR(N) (0x10 + 4 * (N)) /**< Base address register N. */
+#define PCI_REG_IRQ 0x3c        /**< Interrupt line in 7:0. */
+
+/** Classes and subclasses. */
+#define PCI_CLASS_STORAGE 0x01  /**< Mass storage controller. */
+#define PCI_SUBCLASS_IDE 0x01   /**< IDE controller. */
+
+uint32_t pci_read_config (const struct pci_dev *, int reg);
+void pci_write_config (const struct pci_dev *, int reg, uint32_t);
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *);
+bool pci_find_device (uint16_t vendor, uint16_t device, int nth,
+                      struct pci_dev *);
+void pci_enable_bus_master (const struct pci_dev *);
+
+#endif /**< devices/pci.h */
@@ -0,0 +1,82 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/** A RAM disk is a block device whose sectors live in kernel
+   pages, so that reading and writing it costs no more than a
+   memcpy().  It is meant for temporary file systems and swap,
+   and for measuring the file system and VM code without disk
+   latency.  Its contents are lost at power off.
+
+   The disk is built from single pages rather than one large
+   block, which the kernel pool may not have, so a sector is
+   found by way of a table of pages. */
+
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static uint8_t **pages;         /**< Pages holding the disk's sectors. */
+
+static void ramdisk_submit (void *, struct block_request *);
+
+static const struct block_operations ramdisk_operations =
+  {
+    .submit = ramdisk_submit,
+  };
+
+/** Creates a RAM disk of KB kilobytes, rounded up to a whole
+   page, and registers it as block device "ram".  Does nothing if
+   KB is 0.  Its pages come from the kernel pool and start out
+   zeroed. */
+void
+ramdisk_init (size_t kb)
+{
+  size_t page_cnt = DIV_ROUND_UP (kb * 1024, PGSIZE);
+  size_t i;
+
+  if (page_cnt == 0)
+    return;
+
+  pages = malloc (page_cnt * sizeof *pages);
+  if (pages == NULL)
+    PANIC ("ram: out of memory for page table");
+  for (i = 0; i < page_cnt; i++)
+    {
+      pages[i] = palloc_get_page (PAL_ZERO);
+      if (pages[i] == NULL)
+        PANIC ("ram: out of memory after %zu of %zu pages", i, page_cnt);
+    }
+
+  block_register ("ram", BLOCK_RAW, "RAM disk", page_cnt * SECTORS_PER_PAGE,
+                  &ramdisk_operations, NULL);
+}
+
+/** Returns the address of SECTOR's data. */
+static uint8_t *
+sector_data (block_sector_t sector)
+{
+  return (pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/** Block layer submit function.  Carries out REQ at once, one
+   sector at a time, since consecutive sectors need not be in
+   consecutive pages. */
+static void
+ramdisk_submit (void *aux UNUSED, struct block_request *req)
+{
+  uint8_t *buffer = req->buffer;
+  size_t i;
+
+  for (i = 0; i < req->cnt; i++, buffer += BLOCK_SECTOR_SIZE)
+    if (req->write)
+      memcpy (sector_data (req->sector + i), buffer, BLOCK_SECTOR_SIZE);
+    else
+      memcpy (buffer, sector_data (req->sector + i), BLOCK_SECTOR_SIZE);
+  req->done (req);
+}
@@ -9,9 +9,22 @@
 #ifdef USERPROG
 #include "userprog/exception.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/ksm.h"
+#include "vm/page.h"
+#include "vm/zswap.h"
+#endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "devices/stripe.h"
+#include "devices/virtio-blk.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
 #endif
 
 /** Keyboard control register port. */
@@ -20,6 +33,11 @@
 /** How to shut down when shutdown() is called. */
 static enum shutdown_type how = SHUTDOWN_NONE;
 
+/** If true, shutdown_power_off() skips writing back the file
+   system, as if the machine had crashed, so that only what has
+   already reached the disk survives. */
+bool shutdown_nosync;
+
 static void print_stats (void);
 
 /** Shuts down the machine in the way configured by
@@ -91,7 +109,8 @@ shutdown_power_off (void)
   const char *p;
 
 #ifdef FILESYS
-  filesys_done ();
+  if (!shutdown_nosync)
+    filesys_done ();
 #endif
 
   print_stats ();
@@ -132,10 +151,23 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  virtio_blk_print_stats ();
+  stripe_print_stats ();
+  cache_print_stats ();
+  dcache_print_stats ();
+  inode_print_stats ();
+  free_map_print_stats ();
+  journal_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  page_print_stats ();
+  frame_print_stats ();
+  ksm_print_stats ();
+  zswap_print_stats ();
+#endif
 }
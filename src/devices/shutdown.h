@@ -2,6 +2,7 @@
 #define DEVICES_SHUTDOWN_H
 
 #include <debug.h>
+#include <stdbool.h>
 
 /** How to shut down when Pintos has nothing left to do. */
 enum shutdown_type
@@ -11,6 +12,9 @@ enum shutdown_type
     SHUTDOWN_REBOOT,            /**< Reboot the machine (if possible). */
   };
 
+/** -nosync: Power off without writing back the file system. */
+extern bool shutdown_nosync;
+
 void shutdown (void);
 void shutdown_configure (enum shutdown_type);
 void shutdown_reboot (void) NO_RETURN;
@@ -0,0 +1,234 @@
+#include "devices/stripe.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+
+/** A striped block device, "md0", spreads its sectors across
+   several member devices in the manner of RAID-0: its first
+   STRIPE_SECTORS sectors are on the first member, the next
+   STRIPE_SECTORS on the second, and so on around the members
+   again.  A request is split into one chunk per stripe it
+   touches, and each chunk is submitted to its member's queue, so
+   members on different IDE channels, each with its own
+   dispatcher thread, lock and interrupt, transfer at the same
+   time.  Chunks that land next to each other on a member are
+   merged again by that member's queue.
+
+   There is no redundancy: losing any member loses the device. */
+
+/** Most member devices. */
+#define MAX_MEMBERS 4
+
+static struct block *members[MAX_MEMBERS];
+static size_t member_cnt;
+static block_sector_t stripe_sectors;
+
+/** A request to the striped device, in progress. */
+struct stripe_io
+  {
+    struct block_request *parent;       /**< Request to md0. */
+    int pending;                /**< Chunks outstanding, plus 1 while
+                                   still submitting them. */
+    struct list_elem elem;      /**< Element in free_ios. */
+  };
+
+/** The part of a request that falls in one stripe. */
+struct chunk
+  {
+    struct block_request req;   /**< Request to a member. */
+    struct stripe_io *io;       /**< Request it is part of. */
+  };
+
+/** Requests and chunks come from fixed pools, not malloc(),
+   because they are released by completion functions, which may
+   run in interrupt context.  Each free list is protected by
+   disabling interrupts and counted by a semaphore, so that a
+   submitter waits for one to be released if its pool is
+   empty. */
+#define IO_CNT 32
+#define CHUNK_CNT 64
+static struct stripe_io ios[IO_CNT];
+static struct list free_ios;
+static struct semaphore ios_free;
+static struct chunk chunks[CHUNK_CNT];
+static struct list free_chunks;         /**< Linked through REQ.ELEM. */
+static struct semaphore chunks_free;
+
+/** Statistics. */
+static long long request_cnt;           /**< Requests to md0. */
+static long long chunk_cnt;             /**< Chunks they split into. */
+
+static void stripe_submit (void *, struct block_request *);
+
+static const struct block_operations stripe_operations =
+  {
+    .submit = stripe_submit,
+  };
+
+/** Creates block device "md0", striped across the block devices
+   named in NAMES, separated by commas, with stripes of
+   STRIPE_KB kilobytes.  Does nothing if NAMES is null. */
+void
+stripe_init (char *names, size_t stripe_kb)
+{
+  block_sector_t member_size = (block_sector_t) -1;
+  char extra_info[32];
+  char *name, *save_ptr;
+  size_t i;
+
+  if (names == NULL)
+    return;
+
+  stripe_sectors = stripe_kb * 1024 / BLOCK_SECTOR_SIZE;
+  if (stripe_sectors == 0)
+    PANIC ("md0: stripe size must be at least 1 kB");
+  for (name = strtok_r (names, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      struct block *block = block_get_by_name (name);
+      if (block == NULL)
+        PANIC ("No such block device \"%s\"", name);
+      if (member_cnt >= MAX_MEMBERS)
+        PANIC ("md0: more than %d members", MAX_MEMBERS);
+      members[member_cnt++] = block;
+      if (block_size (block) < member_size)
+        member_size = block_size (block);
+    }
+  if (member_cnt == 0)
+    PANIC ("md0: no members");
+
+  list_init (&free_ios);
+  for (i = 0; i < IO_CNT; i++)
+    list_push_back (&free_ios, &ios[i].elem);
+  sema_init (&ios_free, IO_CNT);
+  list_init (&free_chunks);
+  for (i = 0; i < CHUNK_CNT; i++)
+    list_push_back (&free_chunks, &chunks[i].req.elem);
+  sema_init (&chunks_free, CHUNK_CNT);
+
+  /* Every member holds the same number of whole stripes, as
+     many as the smallest has room for. */
+  snprintf (extra_info, sizeof extra_info, "%zu-way stripe of %zu kB",
+            member_cnt, stripe_kb);
+  block_register ("md0", BLOCK_RAW, extra_info,
+                  member_size / stripe_sectors * stripe_sectors * member_cnt,
+                  &stripe_operations, NULL);
+}
+
+/** Prints statistics for the striped device, if there is one. */
+void
+stripe_print_stats (void)
+{
+  if (member_cnt > 0)
+    printf ("md0: %lld requests split into %lld chunks\n",
+            request_cnt, chunk_cnt);
+}
+
+/** Waits for an element of FREE_LIST, counted by FREE_CNT,
+   removes it, and returns it. */
+static struct list_elem *
+take_free (struct list *free_list, struct semaphore *free_cnt)
+{
+  enum intr_level old_level;
+  struct list_elem *e;
+
+  sema_down (free_cnt);
+  old_level = intr_disable ();
+  e = list_pop_front (free_list);
+  intr_set_level (old_level);
+  return e;
+}
+
+/** Returns E to FREE_LIST, counted by FREE_CNT.  May be called
+   in interrupt context. */
+static void
+put_free (struct list *free_list, struct semaphore *free_cnt,
+          struct list_elem *e)
+{
+  enum intr_level old_level = intr_disable ();
+  list_push_back (free_list, e);
+  intr_set_level (old_level);
+  sema_up (free_cnt);
+}
+
+/** Notes that one of IO's chunks has completed, or that all have
+   been submitted, and if that was the last thing outstanding,
+   completes IO's parent request. */
+static void
+finish_io (struct stripe_io *io)
+{
+  struct block_request *parent;
+  enum intr_level old_level;
+  bool done;
+
+  old_level = intr_disable ();
+  done = --io->pending == 0;
+  intr_set_level (old_level);
+  if (!done)
+    return;
+
+  parent = io->parent;
+  put_free (&free_ios, &ios_free, &io->elem);
+  parent->done (parent);
+}
+
+/** Completion function for a chunk. */
+static void
+chunk_done (struct block_request *req)
+{
+  struct chunk *c = req->aux;
+  struct stripe_io *io = c->io;
+
+  put_free (&free_chunks, &chunks_free, &c->req.elem);
+  finish_io (io);
+}
+
+/** Block layer submit function.  Splits REQ at stripe boundaries
+   and submits each piece to the member that holds it. */
+static void
+stripe_submit (void *aux UNUSED, struct block_request *req)
+{
+  struct stripe_io *io = list_entry (take_free (&free_ios, &ios_free),
+                                     struct stripe_io, elem);
+  block_sector_t sector = req->sector;
+  size_t left = req->cnt;
+  uint8_t *buffer = req->buffer;
+  enum intr_level old_level;
+
+  io->parent = req;
+  io->pending = 1;
+  request_cnt++;
+
+  while (left > 0)
+    {
+      block_sector_t stripe = sector / stripe_sectors;
+      block_sector_t ofs = sector % stripe_sectors;
+      size_t cnt = stripe_sectors - ofs < left ? stripe_sectors - ofs : left;
+      struct chunk *c = list_entry (take_free (&free_chunks, &chunks_free),
+                                    struct chunk, req.elem);
+
+      c->io = io;
+      c->req.sector = stripe / member_cnt * stripe_sectors + ofs;
+      c->req.cnt = cnt;
+      c->req.buffer = buffer;
+      c->req.write = req->write;
+      c->req.done = chunk_done;
+      c->req.aux = c;
+
+      old_level = intr_disable ();
+      io->pending++;
+      intr_set_level (old_level);
+      chunk_cnt++;
+      block_submit (members[stripe % member_cnt], &c->req);
+
+      sector += cnt;
+      left -= cnt;
+      buffer += cnt * BLOCK_SECTOR_SIZE;
+    }
+
+  finish_io (io);
+}
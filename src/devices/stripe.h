@@ -0,0 +1,9 @@
+#ifndef DEVICES_STRIPE_H
+#define DEVICES_STRIPE_H
+
+#include <stddef.h>
+
+void stripe_init (char *names, size_t stripe_kb);
+void stripe_print_stats (void);
+
+#endif /**< devices/stripe.h */
@@ -0,0 +1,436 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/** The code in this file drives virtio block devices, the
+   paravirtual disks offered by QEMU and other hypervisors,
+   through the "legacy" PCI interface of [VIRTIO-0.9.5].
+
+   Unlike an IDE channel, which carries out one command at a
+   time, a virtio disk takes requests through a ring shared with
+   the host, the virtqueue, and may have as many outstanding as
+   the ring has room for, completing them in any order.  So
+   rather than have the block layer hand it one request at a
+   time, the driver takes each request as it is submitted,
+   places it in the ring at once, and reports its completion from
+   the interrupt handler. */
+
+/** PCI IDs of a legacy virtio block device. */
+#define VIRTIO_VENDOR 0x1af4
+#define VIRTIO_BLK_DEVICE 0x1001
+
+/** Legacy virtio I/O port addresses. */
+#define reg_features(DISK) ((DISK)->base + 0x00)       /**< Device features. */
+#define reg_guest_features(DISK) ((DISK)->base + 0x04) /**< Driver features. */
+#define reg_queue_pfn(DISK) ((DISK)->base + 0x08)      /**< Ring page number. */
+#define reg_queue_size(DISK) ((DISK)->base + 0x0c)     /**< Ring size (r/o). */
+#define reg_queue_select(DISK) ((DISK)->base + 0x0e)   /**< Selects a ring. */
+#define reg_queue_notify(DISK) ((DISK)->base + 0x10)   /**< Kicks a ring. */
+#define reg_status(DISK) ((DISK)->base + 0x12)         /**< Device status. */
+#define reg_isr(DISK) ((DISK)->base + 0x13)            /**< Reading acks IRQ. */
+#define reg_capacity(DISK) ((DISK)->base + 0x14)       /**< Size in sectors. */
+
+/** Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01 /**< Guest has noticed the device. */
+#define STATUS_DRIVER 0x02      /**< Guest has a driver for it. */
+#define STATUS_DRIVER_OK 0x04   /**< Driver is ready. */
+#define STATUS_FAILED 0x80      /**< Driver gave up on the device. */
+
+/** Physical addresses of rings are given in pages of this many
+   bits, and each ring's used part starts on such a page. */
+#define QUEUE_ADDR_SHIFT 12
+#define QUEUE_ALIGN (1 << QUEUE_ADDR_SHIFT)
+
+/** A buffer descriptor in a ring. */
+struct vring_desc
+  {
+    uint64_t addr;              /**< Physical address. */
+    uint32_t len;               /**< Length in bytes. */
+    uint16_t flags;             /**< VRING_DESC_F_* bits. */
+    uint16_t next;              /**< Next descriptor, if VRING_DESC_F_NEXT. */
+  };
+#define VRING_DESC_F_NEXT 1     /**< Chain continues at NEXT. */
+#define VRING_DESC_F_WRITE 2    /**< Device writes, rather than reads, it. */
+
+/** Descriptor chains made available to the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /**< Where the driver puts the next head. */
+    uint16_t ring[];            /**< Heads of chains. */
+  };
+
+/** Descriptor chains the device has finished with. */
+struct vring_used_elem
+  {
+    uint32_t id;                /**< Head of chain. */
+    uint32_t len;               /**< Bytes written into the chain. */
+  };
+struct vring_used
+  {
+    uint16_t flags;             /**< VRING_USED_F_NO_NOTIFY. */
+    uint16_t idx;               /**< Where the device puts the next head. */
+    struct vring_used_elem ring[];
+  };
+#define VRING_USED_F_NO_NOTIFY 1 /**< Device needs no kick. */
+
+/** Header that starts each request. */
+struct virtio_blk_header
+  {
+    uint32_t type;              /**< VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /**< First sector. */
+  };
+#define VIRTIO_BLK_T_IN 0       /**< Read. */
+#define VIRTIO_BLK_T_OUT 1      /**< Write. */
+
+/** A request takes three descriptors: its header, its data, and
+   the status byte the device writes at the end. */
+#define DESCS_PER_REQUEST 3
+
+/** What a request in the ring needs besides its data: the
+   header and status that its first and last descriptors point
+   to. */
+struct slot
+  {
+    struct virtio_blk_header header;
+    uint8_t status;             /**< 0 if successful. */
+    struct block_request *req;  /**< Request being carried out. */
+  };
+
+/** A virtio block device. */
+struct virtio_disk
+  {
+    char name[8];               /**< Name, e.g. "vda". */
+    uint16_t base;              /**< Base I/O port. */
+    uint8_t irq;                /**< Interrupt in use. */
+
+    /* Virtqueue.  Members below are protected by disabling
+       interrupts, since the interrupt handler uses them too. */
+    uint16_t size;              /**< Descriptors in the ring. */
+    struct vring_desc *desc;    /**< Descriptor table. */
+    struct vring_avail *avail;  /**< Available ring. */
+    struct vring_used *used;    /**< Used ring. */
+    struct slot *slots;         /**< Indexed by head descriptor. */
+    uint16_t free_head;         /**< First free descriptor. */
+    uint16_t free_cnt;          /**< Number of free descriptors. */
+    uint16_t last_used;         /**< Next used entry to look at. */
+    struct list pending;        /**< Requests waiting for room in ring. */
+
+    /* Statistics. */
+    long long request_cnt;      /**< Requests submitted. */
+    int in_flight;              /**< Requests now in the ring. */
+    int max_in_flight;          /**< Most ever in the ring at once. */
+  };
+
+/** Most virtio disks we drive. */
+#define MAX_DISKS 8
+static struct virtio_disk disks[MAX_DISKS];
+static size_t disk_cnt;
+
+static void probe (const struct pci_dev *);
+static void virtio_blk_submit (void *, struct block_request *);
+static void interrupt_handler (struct intr_frame *);
+
+static const struct block_operations virtio_blk_operations =
+  {
+    .submit = virtio_blk_submit,
+  };
+
+/** Detects virtio disks and registers them as block devices. */
+void
+virtio_blk_init (void)
+{
+  struct pci_dev pd;
+  int i;
+
+  for (i = 0; disk_cnt < MAX_DISKS
+         && pci_find_device (VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, i, &pd); i++)
+    probe (&pd);
+}
+
+/** Prints statistics for each virtio disk. */
+void
+virtio_blk_print_stats (void)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    printf ("%s: %lld requests, at most %d in flight\n",
+            disks[i].name, disks[i].request_cnt, disks[i].max_in_flight);
+}
+
+/** Sets up the virtio block device at PD, with a single
+   virtqueue, and registers it. */
+static void
+probe (const struct pci_dev *pd)
+{
+  struct virtio_disk *d = &disks[disk_cnt];
+  uint32_t bar = pci_read_config (pd, PCI_REG_BAR (0));
+  uint8_t irq = pci_read_config (pd, PCI_REG_IRQ) & 0xff;
+  size_t avail_size, used_size;
+  uint32_t capacity_lo, capacity_hi;
+  block_sector_t capacity;
+  uint8_t *ring;
+  char extra_info[32];
+  struct block *block;
+  size_t i;
+
+  snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+  if (!(bar & 1) || irq >= 16)
+    {
+      printf ("%s: no I/O ports or interrupt, ignoring\n", d->name);
+      return;
+    }
+  d->base = bar & ~3u;
+  d->irq = irq + 0x20;
+
+  /* Reset the device, tell it we know how to drive it, and take
+     none of its optional features. */
+  outb (reg_status (d), 0);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE);
+  outb (reg_status (d), STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  inl (reg_features (d));
+  outl (reg_guest_features (d), 0);
+
+  /* Lay out virtqueue 0, at the size the device chose, as the
+     legacy interface requires: descriptors, then the available
+     ring, then on the next page the used ring. */
+  outw (reg_queue_select (d), 0);
+  d->size = inw (reg_queue_size (d));
+  if (d->size < DESCS_PER_REQUEST)
+    {
+      printf ("%s: no usable virtqueue, ignoring\n", d->name);
+      outb (reg_status (d), STATUS_FAILED);
+      return;
+    }
+  avail_size = (sizeof (struct vring_desc) * d->size
+                + sizeof (struct vring_avail) + sizeof (uint16_t) * (d->size + 1));
+  used_size = (sizeof (struct vring_used)
+               + sizeof (struct vring_used_elem) * d->size + sizeof (uint16_t));
+  ring = palloc_get_multiple (PAL_ASSERT | PAL_ZERO,
+                              (ROUND_UP (avail_size, QUEUE_ALIGN)
+                               + ROUND_UP (used_size, QUEUE_ALIGN)) / PGSIZE);
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring + sizeof (struct vring_desc) * d->size);
+  d->used = (struct vring_used *) (ring + ROUND_UP (avail_size, QUEUE_ALIGN));
+  d->slots = calloc (d->size, sizeof *d->slots);
+  if (d->slots == NULL)
+    PANIC ("%s: out of memory for virtqueue", d->name);
+
+  /* Chain every descriptor into the free list. */
+  for (i = 0; i < d->size; i++)
+    d->desc[i].next = i + 1;
+  d->free_head = 0;
+  d->free_cnt = d->size;
+  d->last_used = 0;
+  list_init (&d->pending);
+  d->request_cnt = 0;
+  d->in_flight = d->max_in_flight = 0;
+
+  pci_enable_bus_master (pd);
+  outl (reg_queue_pfn (d), vtop (ring) >> QUEUE_ADDR_SHIFT);
+
+  /* Disks may share an interrupt, in which case the handler
+     looks at each of them. */
+  for (i = 0; i < disk_cnt; i++)
+    if (disks[i].irq == d->irq)
+      break;
+  if (i == disk_cnt)
+    intr_register_ext (d->irq, interrupt_handler, d->name);
+  disk_cnt++;
+  outb (reg_status (d),
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  /* Block devices are limited to 2^32 sectors. */
+  capacity_lo = inl (reg_capacity (d));
+  capacity_hi = inl (reg_capacity (d) + 4);
+  capacity = capacity_hi != 0 ? UINT32_MAX : capacity_lo;
+
+  snprintf (extra_info, sizeof extra_info, "virtio, queue size %u",
+            (unsigned) d->size);
+  block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
+                          &virtio_blk_operations, d);
+  partition_scan (block);
+}
+
+/** Removes a descriptor from D's free list and returns it. */
+static uint16_t
+alloc_desc (struct virtio_disk *d)
+{
+  uint16_t i = d->free_head;
+
+  ASSERT (d->free_cnt > 0);
+  d->free_head = d->desc[i].next;
+  d->free_cnt--;
+  return i;
+}
+
+/** Returns the chain of descriptors headed by HEAD to D's free
+   list. */
+static void
+free_chain (struct virtio_disk *d, uint16_t head)
+{
+  uint16_t i = head;
+
+  for (;;)
+    {
+      bool more = (d->desc[i].flags & VRING_DESC_F_NEXT) != 0;
+      uint16_t next = d->desc[i].next;
+
+      d->desc[i].next = d->free_head;
+      d->free_head = i;
+      d->free_cnt++;
+      if (!more)
+        break;
+      i = next;
+    }
+}
+
+/** Sets descriptor I of D to point to SIZE bytes at BUFFER, with
+   FLAGS, continuing at NEXT if FLAGS includes
+   VRING_DESC_F_NEXT. */
+static void
+set_desc (struct virtio_disk *d, uint16_t i, void *buffer, size_t size,
+          uint16_t flags, uint16_t next)
+{
+  d->desc[i].addr = vtop (buffer);
+  d->desc[i].len = size;
+  d->desc[i].flags = flags;
+  d->desc[i].next = next;
+}
+
+/** Places REQ in D's ring, which must have room for it, without
+   telling the device.  Interrupts must be off. */
+static void
+start_request (struct virtio_disk *d, struct block_request *req)
+{
+  uint16_t head = alloc_desc (d);
+  uint16_t data = alloc_desc (d);
+  uint16_t status = alloc_desc (d);
+  struct slot *s = &d->slots[head];
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  s->header.type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  s->header.reserved = 0;
+  s->header.sector = req->sector;
+  s->status = 0xff;
+  s->req = req;
+
+  set_desc (d, head, &s->header, sizeof s->header, VRING_DESC_F_NEXT, data);
+  set_desc (d, data, req->buffer, req->cnt * BLOCK_SECTOR_SIZE,
+            VRING_DESC_F_NEXT | (req->write ? 0 : VRING_DESC_F_WRITE),
+            status);
+  set_desc (d, status, &s->status, 1, VRING_DESC_F_WRITE, 0);
+
+  /* The device may look at the ring entry as soon as the index
+     passes it, so fill in the entry first. */
+  d->avail->ring[d->avail->idx % d->size] = head;
+  barrier ();
+  d->avail->idx++;
+
+  if (++d->in_flight > d->max_in_flight)
+    d->max_in_flight = d->in_flight;
+}
+
+/** Tells D to look at its ring for new requests, unless it has
+   said it needn't be told. */
+static void
+notify (struct virtio_disk *d)
+{
+  barrier ();
+  if (!(d->used->flags & VRING_USED_F_NO_NOTIFY))
+    outw (reg_queue_notify (d), 0);
+}
+
+/** Block layer submit function.  Places REQ in the ring at once
+   if there is room, or otherwise behind the requests already
+   waiting for room. */
+static void
+virtio_blk_submit (void *d_, struct block_request *req)
+{
+  struct virtio_disk *d = d_;
+  enum intr_level old_level = intr_disable ();
+
+  d->request_cnt++;
+  if (list_empty (&d->pending) && d->free_cnt >= DESCS_PER_REQUEST)
+    {
+      start_request (d, req);
+      notify (d);
+    }
+  else
+    list_push_back (&d->pending, &req->elem);
+  intr_set_level (old_level);
+}
+
+/** Reports the completion of every request D has finished with,
+   then fills the room they leave with waiting requests. */
+static void
+complete_requests (struct virtio_disk *d)
+{
+  bool started = false;
+
+  for (;;)
+    {
+      struct vring_used_elem *e;
+      struct block_request *req;
+      struct slot *s;
+
+      barrier ();
+      if (d->last_used == d->used->idx)
+        break;
+      e = &d->used->ring[d->last_used % d->size];
+      s = &d->slots[e->id];
+      req = s->req;
+      if (s->status != 0)
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu, d->name,
+               req->write ? "write" : "read", req->sector);
+      free_chain (d, e->id);
+      d->last_used++;
+      d->in_flight--;
+
+      /* REQ may be freed as soon as its DONE is called. */
+      req->done (req);
+    }
+
+  while (!list_empty (&d->pending) && d->free_cnt >= DESCS_PER_REQUEST)
+    {
+      struct list_elem *e = list_pop_front (&d->pending);
+      start_request (d, list_entry (e, struct block_request, elem));
+      started = true;
+    }
+  if (started)
+    notify (d);
+}
+
+/** Virtio disk interrupt handler. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct virtio_disk *d = &disks[i];
+
+      if (d->irq == f->vec_no)
+        {
+          /* Reading the ISR acknowledges the interrupt. */
+          inb (reg_isr (d));
+          complete_requests (d);
+        }
+    }
+}
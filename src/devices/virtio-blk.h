@@ -0,0 +1,7 @@
+#ifndef DEVICES_VIRTIO_BLK_H
+#define DEVICES_VIRTIO_BLK_H
+
+void virtio_blk_init (void);
+void virtio_blk_print_stats (void);
+
+#endif /**< devices/virtio-blk.h */
@@ -0,0 +1,573 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/** Buffer cache.  Holds up to CACHE_SIZE sectors of the file
+   system device, shared by inodes, directories, and the free map.
+   Writes go to the cache only; a dirty sector reaches the disk
+   when it is evicted, at cache_sync() or cache_flush(), or from
+   the flusher thread, which wakes every FLUSH_PERIOD ticks and
+   writes back the sectors that have been dirty for DIRTY_EXPIRE
+   ticks.  Once more than DIRTY_HIGH sectors are dirty, a writer
+   writes back every dirty sector itself before going on.  Sectors
+   are written back in ascending order, to keep the disk head
+   moving in one direction.  A sector written through the journal
+   is held back until its transaction is committed. */
+#define CACHE_SIZE 64
+#define FLUSH_PERIOD TIMER_FREQ
+#define DIRTY_EXPIRE (5 * TIMER_FREQ)
+#define DIRTY_HIGH (CACHE_SIZE * 3 / 4)
+
+/** The flusher also checkpoints the journal this often. */
+#define CHECKPOINT_PERIOD (30 * TIMER_FREQ)
+
+/** A cached sector.
+
+   SECTOR, VALID, ACCESSED, and PIN_CNT are protected by
+   cache_lock.  DIRTY, DIRTY_TIME, and DATA are protected by
+   LOCK, which a
+   thread may only take while it holds a pin.  An entry with a
+   zero PIN_CNT therefore has LOCK free and may be reassigned.
+   LOGGED changes only with both held, so either suffices to read
+   it. */
+struct cache_entry
+  {
+    block_sector_t sector;              /**< Sector held, if VALID. */
+    bool valid;                         /**< True if SECTOR is meaningful. */
+    bool accessed;                      /**< Used since the clock hand passed. */
+    bool dirty;                         /**< Modified since read or written. */
+    int64_t dirty_time;                 /**< Ticks when DIRTY was set. */
+    bool logged;                        /**< In the running transaction. */
+    int pin_cnt;                        /**< Threads using the entry. */
+    struct lock lock;                   /**< Serializes I/O and data access. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /**< Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static size_t clock_hand;
+static size_t dirty_cnt;            /**< Dirty entries, under cache_lock. */
+
+/** Batched I/O.  cache_writeback(), cache_fill(), and the
+   read-ahead thread each lock a batch of entries and submit a
+   request for every one of them before waiting for any, so that
+   the block layer can order and merge them.  BATCH_LOCK protects
+   BATCH_REQS and comes before any entry's LOCK. */
+static struct block_request batch_reqs[CACHE_SIZE];
+static struct semaphore batch_done;
+static struct lock batch_lock;
+
+/** Read-ahead queue.  Sectors queued by cache_read_ahead() are
+   brought in by the read-ahead thread.  When the queue is full,
+   further requests are dropped. */
+#define RA_QUEUE_SIZE 64
+static block_sector_t ra_queue[RA_QUEUE_SIZE];
+static size_t ra_head, ra_cnt;
+static struct lock ra_lock;
+static struct condition ra_cond;
+
+/** Statistics. */
+static long long hit_cnt;           /**< # of lookups found in the cache. */
+static long long miss_cnt;          /**< # of lookups that were not. */
+static long long writeback_cnt;     /**< # of dirty sectors written out. */
+static long long throttle_cnt;      /**< # of writebacks forced by writers. */
+static long long ra_read_cnt;       /**< # of sectors read ahead. */
+
+static struct cache_entry *cache_get (block_sector_t, bool read,
+                                      bool only_new);
+static void cache_put (struct cache_entry *);
+static thread_func flusher NO_RETURN;
+static thread_func read_ahead_daemon NO_RETURN;
+
+/** Initializes the buffer cache and starts the flusher and
+   read-ahead threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  lock_init (&batch_lock);
+  sema_init (&batch_done, 0);
+  for (i = 0; i < CACHE_SIZE; i++)
+    lock_init (&cache[i].lock);
+  lock_init (&ra_lock);
+  cond_init (&ra_cond);
+  thread_create ("flusher", PRI_DEFAULT, flusher, NULL);
+  thread_create ("readahead", PRI_DEFAULT, read_ahead_daemon, NULL);
+}
+
+/** Chooses an unpinned entry to reuse, with the clock algorithm.
+   Returns a null pointer if every entry is pinned. */
+static struct cache_entry *
+cache_victim (void)
+{
+  size_t tries;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (tries = 0; tries < 2 * CACHE_SIZE; tries++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+
+      clock_hand = (clock_hand + 1) % CACHE_SIZE;
+      if (e->pin_cnt > 0 || e->logged)
+        continue;
+      if (!e->valid || !e->accessed)
+        return e;
+      e->accessed = false;
+    }
+  return NULL;
+}
+
+/** Writes E back to disk if it is dirty, unless its transaction
+   has yet to commit.  E must be locked. */
+static void
+cache_clean (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (e->dirty && !e->logged)
+    {
+      block_write (fs_device, e->sector, e->data);
+      e->dirty = false;
+      lock_acquire (&cache_lock);
+      dirty_cnt--;
+      writeback_cnt++;
+      lock_release (&cache_lock);
+    }
+}
+
+/** Marks E, which must be locked, as modified. */
+static void
+cache_dirty (struct cache_entry *e)
+{
+  ASSERT (lock_held_by_current_thread (&e->lock));
+
+  if (!e->dirty)
+    {
+      e->dirty = true;
+      e->dirty_time = timer_ticks ();
+      lock_acquire (&cache_lock);
+      dirty_cnt++;
+      lock_release (&cache_lock);
+    }
+}
+
+/** Completion function for batched requests. */
+static void
+batch_request_done (struct block_request *r UNUSED)
+{
+  sema_up (&batch_done);
+}
+
+/** Reads into or, if WRITE is true, writes from the CNT locked
+   entries in BATCH, and waits until all are done.  The caller
+   must hold batch_lock. */
+static void
+cache_batch_io (struct cache_entry **batch, size_t cnt, bool write)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&batch_lock));
+  ASSERT (cnt <= CACHE_SIZE);
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct block_request *r = &batch_reqs[i];
+
+      r->sector = batch[i]->sector;
+      r->cnt = 1;
+      r->buffer = batch[i]->data;
+      r->write = write;
+      r->done = batch_request_done;
+      r->aux = NULL;
+      block_submit (fs_device, r);
+    }
+  for (i = 0; i < cnt; i++)
+    sema_down (&batch_done);
+}
+
+/** Writes back every dirty sector that has been dirty for at
+   least AGE ticks, except those in the running transaction, all
+   at once. */
+static void
+cache_writeback (int64_t age)
+{
+  struct cache_entry *batch[CACHE_SIZE];
+  int64_t now = timer_ticks ();
+  size_t cnt = 0;
+  size_t i, n;
+
+  /* Take batch_lock first, so that cache_fill() never finds the
+     cache pinned full by a writeback waiting for it. */
+  lock_acquire (&batch_lock);
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      if (e->valid && e->dirty && !e->logged && now - e->dirty_time >= age)
+        {
+          e->pin_cnt++;
+          batch[cnt++] = e;
+        }
+    }
+  lock_release (&cache_lock);
+
+  /* DIRTY and LOGGED may have changed before we locked the
+     entries, so check them again. */
+  for (i = n = 0; i < cnt; i++)
+    {
+      struct cache_entry *e = batch[i];
+
+      lock_acquire (&e->lock);
+      if (e->dirty && !e->logged)
+        batch[n++] = e;
+      else
+        cache_put (e);
+    }
+
+  cache_batch_io (batch, n, true);
+  for (i = 0; i < n; i++)
+    batch[i]->dirty = false;
+  lock_acquire (&cache_lock);
+  dirty_cnt -= n;
+  writeback_cnt += n;
+  lock_release (&cache_lock);
+  for (i = 0; i < n; i++)
+    cache_put (batch[i]);
+  lock_release (&batch_lock);
+}
+
+/** Returns the entry for SECTOR, pinned and locked, bringing the
+   sector in if necessary.  If READ is false the caller will
+   overwrite the whole sector, so it is not read from disk.  If
+   ONLY_NEW is true and SECTOR is already cached, returns a null
+   pointer instead. */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read, bool only_new)
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+      size_t i;
+
+      lock_acquire (&cache_lock);
+      for (i = 0; i < CACHE_SIZE; i++)
+        {
+          e = &cache[i];
+          if (e->valid && e->sector == sector)
+            {
+              if (only_new)
+                {
+                  lock_release (&cache_lock);
+                  return NULL;
+                }
+              e->pin_cnt++;
+              e->accessed = true;
+              hit_cnt++;
+              lock_release (&cache_lock);
+              lock_acquire (&e->lock);
+              return e;
+            }
+        }
+
+      e = cache_victim ();
+      if (e == NULL)
+        {
+          /* Everything is in use.  Wait for someone to finish. */
+          lock_release (&cache_lock);
+          thread_yield ();
+          continue;
+        }
+
+      if (e->valid && e->dirty)
+        {
+          /* Write the victim back under its old identity, so that
+             a lookup of that sector meanwhile still finds it.
+             Then start over, since SECTOR may have been brought
+             in by someone else. */
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          cache_clean (e);
+          lock_release (&e->lock);
+          lock_acquire (&cache_lock);
+          e->pin_cnt--;
+          lock_release (&cache_lock);
+          continue;
+        }
+
+      /* Nobody holds an unpinned entry's lock, so this does not
+         block. */
+      e->sector = sector;
+      e->valid = true;
+      e->accessed = true;
+      e->pin_cnt = 1;
+      lock_acquire (&e->lock);
+      miss_cnt++;
+      lock_release (&cache_lock);
+
+      e->dirty = false;
+      if (read)
+        block_read (fs_device, sector, e->data);
+      return e;
+    }
+}
+
+/** Unlocks and unpins E. */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+  lock_acquire (&cache_lock);
+  e->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/** Reads sector SECTOR into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/** Writes BUFFER to sector SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/** Reads SIZE bytes at offset OFS within sector SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true, false);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/** Writes SIZE bytes from BUFFER at offset OFS within sector
+   SECTOR. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, false);
+  memcpy (e->data + ofs, buffer, size);
+  cache_dirty (e);
+  cache_put (e);
+
+  /* Don't let dirty sectors crowd out the rest of the cache.  Those
+     in the running transaction can't be written back, but there
+     are fewer of them than DIRTY_HIGH. */
+  if (dirty_cnt > DIRTY_HIGH)
+    {
+      cache_writeback (0);
+      throttle_cnt++;
+    }
+}
+
+/** Writes BUFFER to sector SECTOR as part of the running journal
+   operation. */
+void
+cache_log_write (block_sector_t sector, const void *buffer)
+{
+  cache_log_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/** Writes SIZE bytes from BUFFER at offset OFS within sector
+   SECTOR as part of the running journal operation.  The sector
+   stays in the cache until the transaction commits. */
+void
+cache_log_write_at (block_sector_t sector, const void *buffer,
+                    int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+  ASSERT (journal_active ());
+
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE, false);
+  if (!e->logged)
+    {
+      /* Changes from a committed transaction must reach the disk
+         before the sector joins a new one, because the log that
+         holds them may be emptied before the new one commits. */
+      cache_clean (e);
+      lock_acquire (&cache_lock);
+      e->logged = true;
+      lock_release (&cache_lock);
+      journal_log (sector);
+    }
+  memcpy (e->data + ofs, buffer, size);
+  cache_dirty (e);
+  cache_put (e);
+}
+
+/** Releases SECTOR, which is in a transaction that has just been
+   committed, to be written back like any other sector. */
+void
+cache_unlog (block_sector_t sector)
+{
+  struct cache_entry *e = cache_get (sector, true, false);
+
+  ASSERT (e->logged);
+  lock_acquire (&cache_lock);
+  e->logged = false;
+  lock_release (&cache_lock);
+  cache_put (e);
+}
+
+/** Brings the CNT sectors in SECTORS into the cache, reading
+   those that are not already cached all at once, so that the
+   block layer can order them and merge consecutive ones into a
+   single request.  CNT must not exceed CACHE_RUN_MAX.  Returns
+   the number of sectors read. */
+size_t
+cache_fill (const block_sector_t *sectors, size_t cnt)
+{
+  struct cache_entry *batch[CACHE_RUN_MAX];
+  size_t i, n;
+
+  ASSERT (cnt <= CACHE_RUN_MAX);
+
+  /* Claim entries for the sectors, so that anyone looking for
+     one of them waits for it to be read. */
+  lock_acquire (&batch_lock);
+  for (i = n = 0; i < cnt; i++)
+    {
+      batch[n] = cache_get (sectors[i], false, true);
+      if (batch[n] != NULL)
+        n++;
+    }
+
+  cache_batch_io (batch, n, false);
+  for (i = 0; i < n; i++)
+    cache_put (batch[i]);
+  lock_release (&batch_lock);
+  return n;
+}
+
+/** Queues SECTOR to be brought into the cache in the background,
+   because it will probably be read soon. */
+void
+cache_read_ahead (block_sector_t sector)
+{
+  lock_acquire (&ra_lock);
+  if (ra_cnt < RA_QUEUE_SIZE)
+    {
+      ra_queue[(ra_head + ra_cnt++) % RA_QUEUE_SIZE] = sector;
+      cond_signal (&ra_cond, &ra_lock);
+    }
+  lock_release (&ra_lock);
+}
+
+/** Writes SECTOR back to disk now if it is cached and dirty,
+   unless its transaction has yet to commit. */
+void
+cache_sync (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &cache[i];
+
+      if (e->valid && e->sector == sector)
+        {
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          cache_clean (e);
+          cache_put (e);
+          return;
+        }
+    }
+  lock_release (&cache_lock);
+}
+
+/** Writes every dirty sector back to disk, except those in the
+   running transaction. */
+void
+cache_flush (void)
+{
+  cache_writeback (0);
+}
+
+/** Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Cache: %lld hits, %lld misses, %lld writebacks "
+          "(%lld forced by writers), %lld sectors read ahead\n",
+          hit_cnt, miss_cnt, writeback_cnt, throttle_cnt, ra_read_cnt);
+}
+
+/** Flusher thread.  Commits the journal and writes back old dirty
+   sectors periodically, to bound how much is lost in a crash, and
+   checkpoints the journal less often. */
+static void
+flusher (void *aux UNUSED)
+{
+  int64_t last_checkpoint = timer_ticks ();
+
+  for (;;)
+    {
+      timer_sleep (FLUSH_PERIOD);
+      if (timer_elapsed (last_checkpoint) >= CHECKPOINT_PERIOD)
+        {
+          journal_commit ();
+          journal_checkpoint ();
+          last_checkpoint = timer_ticks ();
+        }
+      else
+        {
+          journal_commit ();
+          cache_writeback (DIRTY_EXPIRE);
+        }
+    }
+}
+
+/** Read-ahead thread.  Brings in queued sectors that are not
+   already cached, up to CACHE_RUN_MAX at a time. */
+static void
+read_ahead_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      block_sector_t sectors[CACHE_RUN_MAX];
+      size_t cnt;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_cond, &ra_lock);
+      for (cnt = 0; cnt < CACHE_RUN_MAX && ra_cnt > 0; cnt++)
+        {
+          sectors[cnt] = ra_queue[ra_head];
+          ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+          ra_cnt--;
+        }
+      lock_release (&ra_lock);
+
+      ra_read_cnt += cache_fill (sectors, cnt);
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "devices/block.h"
+
+/** Most sectors cache_fill() reads at once. */
+#define CACHE_RUN_MAX 16
+
+void cache_init (void);
+void cache_read (block_sector_t, void *buffer);
+void cache_write (block_sector_t, const void *buffer);
+void cache_read_at (block_sector_t, void *buffer, int ofs, int size);
+void cache_write_at (block_sector_t, const void *buffer, int ofs, int size);
+void cache_log_write (block_sector_t, const void *buffer);
+void cache_log_write_at (block_sector_t, const void *buffer,
+                         int ofs, int size);
+void cache_unlog (block_sector_t);
+size_t cache_fill (const block_sector_t *, size_t cnt);
+void cache_read_ahead (block_sector_t);
+void cache_sync (block_sector_t);
+void cache_flush (void);
+void cache_print_stats (void);
+
+#endif /**< filesys/cache.h */
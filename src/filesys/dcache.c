@@ -0,0 +1,191 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/** Directory entry cache.  Remembers, for up to DCACHE_SIZE names,
+   the inode sector that a name maps to in a directory, or that it
+   maps to nothing, so that repeated lookups of the same names
+   need not search the directory at all.  Entries are keyed by the
+   directory's inode sector and the name, and the least recently
+   used entry is dropped to make room for a new one.
+
+   The directory code keeps the cache coherent: it updates the
+   entry for a name whenever it adds or removes that name. */
+#define DCACHE_SIZE 256
+
+/** A cached name.  SECTOR is 0 for a negative entry, one that
+   records that DIR has no entry named NAME. */
+struct dentry
+  {
+    block_sector_t dir;                 /**< Directory's inode sector. */
+    char name[NAME_MAX + 1];            /**< Null terminated file name. */
+    block_sector_t sector;              /**< Inode sector, or 0. */
+    struct hash_elem hash_elem;         /**< Element in dentries. */
+    struct list_elem lru_elem;          /**< Element in lru_list. */
+  };
+
+static struct hash dentries;            /**< All entries. */
+static struct list lru_list;            /**< Least recently used first. */
+static struct lock dcache_lock;         /**< Protects the above. */
+
+/** Statistics. */
+static long long hit_cnt;           /**< # of lookups of a known file. */
+static long long neg_hit_cnt;       /**< # of lookups of a known absence. */
+static long long miss_cnt;          /**< # of lookups not in the cache. */
+
+static hash_hash_func dentry_hash;
+static hash_less_func dentry_less;
+
+/** Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("dcache: hash table creation failed");
+  list_init (&lru_list);
+  lock_init (&dcache_lock);
+}
+
+/** Returns the entry for NAME in directory DIR, or a null
+   pointer if there is none.  The caller must hold dcache_lock. */
+static struct dentry *
+dentry_find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/** Looks up NAME in the directory whose inode is in sector DIR.
+   If the cache knows the answer, stores the inode sector of the
+   file NAME refers to in *SECTORP, or 0 if there is no such
+   file, and returns true.  Otherwise returns false. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return false;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_back (&lru_list, &d->lru_elem);
+      *sectorp = d->sector;
+      if (d->sector != 0)
+        hit_cnt++;
+      else
+        neg_hit_cnt++;
+    }
+  else
+    miss_cnt++;
+  lock_release (&dcache_lock);
+
+  return d != NULL;
+}
+
+/** Records that NAME in the directory whose inode is in sector
+   DIR refers to the inode in SECTOR, or to nothing if SECTOR is
+   0. */
+void
+dcache_insert (block_sector_t dir, const char *name, block_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else
+    {
+      if (hash_size (&dentries) >= DCACHE_SIZE)
+        {
+          /* Reuse the least recently used entry. */
+          d = list_entry (list_pop_front (&lru_list),
+                          struct dentry, lru_elem);
+          hash_delete (&dentries, &d->hash_elem);
+        }
+      else
+        {
+          d = malloc (sizeof *d);
+          if (d == NULL)
+            {
+              lock_release (&dcache_lock);
+              return;
+            }
+        }
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  d->sector = sector;
+  list_push_back (&lru_list, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/** Forgets whatever the cache knows about NAME in the directory
+   whose inode is in sector DIR. */
+void
+dcache_invalidate (block_sector_t dir, const char *name)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (dir, name);
+  if (d != NULL)
+    {
+      hash_delete (&dentries, &d->hash_elem);
+      list_remove (&d->lru_elem);
+      free (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/** Prints directory entry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dcache: %lld hits, %lld negative hits, %lld misses\n",
+          hit_cnt, neg_hit_cnt, miss_cnt);
+}
+
+/** Returns a hash of the directory and name of dentry E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/** Orders dentries by directory, then by name. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
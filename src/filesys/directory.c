@@ -1,7 +1,9 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -11,6 +13,8 @@ struct dir
   {
     struct inode *inode;                /**< Backing store. */
     off_t pos;                          /**< Current position. */
+    uint32_t chain;                     /**< Bucket at the head of the
+                                           chain that POS is in. */
   };
 
 /** A single directory entry. */
@@ -21,12 +25,64 @@ struct dir_entry
     bool in_use;                        /**< In use or free? */
   };
 
-/** Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/** A directory is a hash table of buckets, one sector each.  The
+   first DIR_BUCKETS buckets are indexed by the hash of the name;
+   a bucket that fills up chains to an overflow bucket appended
+   at the end of the directory, whose number it stores in the
+   last word of its sector.  Overflow buckets are numbered from
+   DIR_BUCKETS up, so a bucket number of 0 ends a chain.
+   The directory file is sparse, so buckets that have never held
+   an entry take no space on disk. */
+#define DIR_BUCKETS 512
+#define BUCKET_ENTRIES ((BLOCK_SECTOR_SIZE - sizeof (uint32_t)) \
+                        / sizeof (struct dir_entry))
+#define BUCKET_NEXT_OFS (BLOCK_SECTOR_SIZE - sizeof (uint32_t))
+
+/** Returns the byte offset of entry SLOT in bucket BUCKET. */
+static off_t
+entry_ofs (uint32_t bucket, size_t slot)
+{
+  return (off_t) bucket * BLOCK_SECTOR_SIZE + slot * sizeof (struct dir_entry);
+}
+
+/** Returns the bucket that BUCKET in DIR chains to, or 0 if it
+   is the last in its chain. */
+static uint32_t
+bucket_next (const struct dir *dir, uint32_t bucket)
+{
+  uint32_t next;
+
+  if (inode_read_at (dir->inode, &next, sizeof next,
+                     (off_t) bucket * BLOCK_SECTOR_SIZE + BUCKET_NEXT_OFS)
+      != sizeof next)
+    return 0;
+  return next;
+}
+
+/** Makes BUCKET in DIR chain to NEXT.
+   Returns true if successful, false on failure. */
+static bool
+set_bucket_next (struct dir *dir, uint32_t bucket, uint32_t next)
+{
+  return inode_write_at (dir->inode, &next, sizeof next,
+                         (off_t) bucket * BLOCK_SECTOR_SIZE + BUCKET_NEXT_OFS)
+         == sizeof next;
+}
+
+/** Returns the bucket at the head of NAME's chain. */
+static uint32_t
+name_bucket (const char *name)
+{
+  return hash_string (name) % DIR_BUCKETS;
+}
+
+/** Creates an empty directory in the given SECTOR.  Only its
+   inode is written; buckets are allocated as entries are added.
+   Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  return inode_create (sector, DIR_BUCKETS * BLOCK_SECTOR_SIZE, true);
 }
 
 /** Opens and returns the directory for the given INODE, of which
@@ -39,6 +95,7 @@ dir_open (struct inode *inode)
     {
       dir->inode = inode;
       dir->pos = 0;
+      dir->chain = 0;
       return dir;
     }
   else
@@ -93,41 +150,63 @@ lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
   struct dir_entry e;
-  size_t ofs;
+  uint32_t bucket;
+  size_t slot;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  bucket = name_bucket (name);
+  do
+    {
+      for (slot = 0; slot < BUCKET_ENTRIES; slot++)
+        {
+          off_t ofs = entry_ofs (bucket, slot);
+          if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+            return false;
+          if (e.in_use && !strcmp (name, e.name)) 
+            {
+              if (ep != NULL)
+                *ep = e;
+              if (ofsp != NULL)
+                *ofsp = ofs;
+              return true;
+            }
+        }
+      bucket = bucket_next (dir, bucket);
+    }
+  while (bucket != 0);
   return false;
 }
 
 /** Searches DIR for a file with the given NAME
    and returns true if one exists, false otherwise.
    On success, sets *INODE to an inode for the file, otherwise to
-   a null pointer.  The caller must close *INODE. */
+   a null pointer.  The caller must close *INODE.
+   Answers from the directory entry cache when it can, and
+   records the answer there when it cannot.  Holds DIR's inode
+   lock throughout, so that NAME cannot be removed, and its inode
+   freed, between finding and opening it. */
 bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector;
+  block_sector_t sector;
   struct dir_entry e;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  dir_sector = inode_get_inumber (dir->inode);
+  inode_lock (dir->inode);
+  if (!dcache_lookup (dir_sector, name, &sector))
+    {
+      sector = lookup (dir, name, &e, NULL) ? e.inode_sector : 0;
+      dcache_insert (dir_sector, name, sector);
+    }
+  *inode = sector != 0 ? inode_open (sector) : NULL;
+  inode_unlock (dir->inode);
 
   return *inode != NULL;
 }
@@ -142,6 +221,9 @@ bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
   struct dir_entry e;
+  uint32_t bucket, next;
+  uint32_t overflow = 0;
+  size_t slot;
   off_t ofs;
   bool success = false;
 
@@ -152,29 +234,57 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  inode_lock (dir->inode);
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
+  /* Whatever happens below, the cached entry for NAME may no
+     longer be right. */
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+
+  /* Set OFS to offset of a free slot in NAME's chain.
      
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  for (bucket = name_bucket (name); ; bucket = next)
+    {
+      for (slot = 0; slot < BUCKET_ENTRIES; slot++)
+        {
+          ofs = entry_ofs (bucket, slot);
+          if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+            goto done;
+          if (!e.in_use)
+            goto write;
+        }
+      next = bucket_next (dir, bucket);
+      if (next == 0)
+        break;
+    }
+
+  /* The chain is full.  Append an overflow bucket, extending the
+     directory through its last word, and use its first slot.  It
+     is linked into the chain only once the entry is written. */
+  overflow = inode_length (dir->inode) / BLOCK_SECTOR_SIZE;
+  if (!set_bucket_next (dir, overflow, 0))
+    goto done;
+  ofs = entry_ofs (overflow, 0);
 
+ write:
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success && overflow != 0)
+    success = set_bucket_next (dir, bucket, overflow);
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
 
  done:
+  inode_unlock (dir->inode);
   return success;
 }
 
@@ -192,6 +302,8 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  inode_lock (dir->inode);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -202,29 +314,57 @@ dir_remove (struct dir *dir, const char *name)
     goto done;
 
   /* Erase directory entry. */
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
 
   /* Remove inode. */
   inode_remove (inode);
+  dcache_insert (inode_get_inumber (dir->inode), name, 0);
   success = true;
 
  done:
+  inode_unlock (dir->inode);
   inode_close (inode);
   return success;
 }
 
 /** Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.  Entries come back chain by chain,
+   not in the order they were added.  Only chains whose first
+   bucket is on disk are read, and within a chain only the
+   overflow buckets it links to. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  for (;;)
     {
+      /* From past the last slot of a bucket, go on to the next
+         bucket in its chain, or else to the next chain. */
+      if (dir->pos % BLOCK_SECTOR_SIZE >= entry_ofs (0, BUCKET_ENTRIES))
+        {
+          uint32_t next = bucket_next (dir, dir->pos / BLOCK_SECTOR_SIZE);
+          if (next == 0)
+            next = ++dir->chain;
+          dir->pos = entry_ofs (next, 0);
+        }
+
+      /* At the head of a chain, skip to the next head bucket that
+         is not a hole. */
+      if (dir->pos == entry_ofs (dir->chain, 0))
+        {
+          off_t ofs = inode_next_data (dir->inode, dir->pos);
+          if (ofs < 0 || ofs >= entry_ofs (DIR_BUCKETS, 0))
+            break;
+          dir->pos = ofs;
+          dir->chain = ofs / BLOCK_SECTOR_SIZE;
+        }
+      if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+        break;
       dir->pos += sizeof e;
       if (e.in_use)
         {
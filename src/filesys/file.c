@@ -1,16 +1,29 @@
 #include "filesys/file.h"
 #include <debug.h>
 #include "filesys/inode.h"
+#include "devices/block.h"
 #include "threads/malloc.h"
 
+/** Read-ahead window, in bytes.  A file_read() that starts where
+   the previous one ended opens a window of RA_INIT bytes past the
+   data it read, doubling on each further sequential read up to
+   RA_MAX.  Any other read closes the window. */
+#define RA_INIT (4 * BLOCK_SECTOR_SIZE)
+#define RA_MAX (32 * BLOCK_SECTOR_SIZE)
+
 /** An open file. */
 struct file 
   {
     struct inode *inode;        /**< File's inode. */
     off_t pos;                  /**< Current position. */
     bool deny_write;            /**< Has file_deny_write() been called? */
+    off_t ra_next;              /**< Where a sequential read would start. */
+    off_t ra_end;               /**< End of data already read ahead. */
+    off_t ra_size;              /**< Read-ahead window, 0 if closed. */
   };
 
+static void file_read_ahead (struct file *, off_t bytes_read);
+
 /** Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -69,10 +82,44 @@ off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
   off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  file_read_ahead (file, bytes_read);
   file->pos += bytes_read;
   return bytes_read;
 }
 
+/** Updates FILE's read-ahead window for a read of BYTES_READ bytes
+   at its current position and queues whatever the window now
+   covers that has not been queued before. */
+static void
+file_read_ahead (struct file *file, off_t bytes_read)
+{
+  off_t end = file->pos + bytes_read;
+  off_t start;
+
+  if (bytes_read == 0)
+    return;
+
+  if (file->pos == file->ra_next && file->pos > 0)
+    file->ra_size = (file->ra_size == 0 ? RA_INIT
+                     : file->ra_size * 2 < RA_MAX ? file->ra_size * 2
+                     : RA_MAX);
+  else
+    {
+      file->ra_size = 0;
+      file->ra_end = 0;
+    }
+  file->ra_next = end;
+
+  if (file->ra_size == 0)
+    return;
+  start = file->ra_end > end ? file->ra_end : end;
+  if (start < end + file->ra_size)
+    {
+      inode_read_ahead (file->inode, start, end + file->ra_size);
+      file->ra_end = end + file->ra_size;
+    }
+}
+
 /** Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -87,9 +134,8 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 /** Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file extends the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -102,9 +148,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /** Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file extends the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
@@ -140,6 +185,14 @@ file_allow_write (struct file *file)
     }
 }
 
+/** Forces FILE's data and metadata to disk. */
+void
+file_sync (struct file *file) 
+{
+  ASSERT (file != NULL);
+  inode_sync (file->inode);
+}
+
 /** Returns the size of FILE in bytes. */
 off_t
 file_length (struct file *file) 
@@ -2,15 +2,28 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/journal.h"
 #include "threads/synch.h"
 
 /** Partition that contains the file system. */
 struct block *fs_device;
 
+/** Journal credits for creating a file: the free map sector for
+   its inode, the inode itself, and adding its directory entry,
+   which may grow the directory by a bucket and link the bucket
+   into its chain. */
+#define CREATE_CREDITS (2 + INODE_GROW_CREDITS + 1)
+
+/** Journal credits for removing a file: its directory entry.  The
+   sectors it frees are charged when the free map is flushed. */
+#define REMOVE_CREDITS 1
+
 static void do_format (void);
 
 /** Initializes the file system module.
@@ -22,15 +35,16 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
+  dcache_init ();
   inode_init ();
   free_map_init ();
+  journal_init (format);
 
   if (format) 
     do_format ();
 
   free_map_open ();
-
-  lock_init(&filesys_lock);
 }
 
 /** Shuts down the file system module, writing any unwritten data
@@ -38,6 +52,7 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  journal_flush ();
   free_map_close ();
 }
 
@@ -49,14 +64,19 @@ bool
 filesys_create (const char *name, off_t initial_size) 
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  struct dir *dir;
+  bool success;
+
+  journal_begin (CREATE_CREDITS);
+  dir = dir_open_root ();
+  success = (dir != NULL
+             && free_map_allocate (1, &inode_sector)
+             && inode_create (inode_sector, initial_size, false)
+             && dir_add (dir, name, inode_sector));
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
+  journal_end ();
 
   return success;
 }
@@ -86,9 +106,14 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name) 
 {
-  struct dir *dir = dir_open_root ();
-  bool success = dir != NULL && dir_remove (dir, name);
+  struct dir *dir;
+  bool success;
+
+  journal_begin (REMOVE_CREDITS);
+  dir = dir_open_root ();
+  success = dir != NULL && dir_remove (dir, name);
   dir_close (dir); 
+  journal_end ();
 
   return success;
 }
@@ -99,8 +124,11 @@ do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  journal_begin (1);
+  if (!dir_create (ROOT_DIR_SECTOR))
     PANIC ("root directory creation failed");
+  journal_end ();
+  journal_flush ();
   free_map_close ();
   printf ("done.\n");
 }
@@ -3,18 +3,15 @@
 
 #include <stdbool.h>
 #include "filesys/off_t.h"
-#include "threads/synch.h"
 
 /** Sectors of system file inodes. */
 #define FREE_MAP_SECTOR 0       /**< Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /**< Root directory file inode sector. */
+#define JOURNAL_SECTOR 2        /**< First sector of the journal. */
 
 /** Block device that contains the file system. */
 struct block *fs_device;
 
-/** Ensure that only one process is accessing file system. */
-struct lock filesys_lock;
-
 void filesys_init (bool format);
 void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
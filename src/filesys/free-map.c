@@ -1,12 +1,88 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <limits.h>
+#include <round.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /**< Free map file. */
 static struct bitmap *free_map;      /**< Free map, one bit per sector. */
+static struct lock free_map_lock;    /**< Protects the free map. */
+
+/** Changes to the free map reach its file only at
+   free_map_flush(), and then only for the sectors of the file
+   whose bits changed, one bit per sector of the free map file.
+   Allocations must be written in the transaction of the
+   operation that made them, which pays for them out of its
+   journal credits, so they go in DIRTY_MAP.  Frees at a
+   checkpoint are already committed and can wait, so they go in
+   LAZY_MAP, to be written as room allows. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * CHAR_BIT)
+static struct bitmap *dirty_map;     /**< Free map sectors to write. */
+static struct bitmap *lazy_map;      /**< Free map sectors to write later. */
+
+/** Released sectors stay allocated until the journal has
+   committed the operation that released them and then
+   checkpointed, since until then replaying the log could write
+   over them.  RELEASED_MAP holds sectors released since the last
+   commit, COMMITTED_MAP those released before it. */
+static struct bitmap *released_map;
+static struct bitmap *committed_map;
+
+/** Statistics. */
+static long long write_cnt;          /**< # of free map sectors written. */
+
+/** Notes that the running operation has allocated the CNT
+   sectors starting at SECTOR, charging it for each free map
+   sector that it is the first to change.  The caller must hold
+   free_map_lock. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  for (i = sector / BITS_PER_SECTOR;
+       i <= (sector + cnt - 1) / BITS_PER_SECTOR; i++)
+    if (!bitmap_test (dirty_map, i))
+      {
+        bitmap_mark (dirty_map, i);
+        bitmap_reset (lazy_map, i);
+        journal_charge ();
+      }
+}
+
+/** Notes that the bit for SECTOR has been freed.  The caller must
+   hold free_map_lock. */
+static void
+mark_lazy (block_sector_t sector)
+{
+  size_t i = sector / BITS_PER_SECTOR;
+
+  if (!bitmap_test (dirty_map, i))
+    bitmap_mark (lazy_map, i);
+}
+
+/** Writes free map sector I to the free map file.  The caller
+   must hold free_map_lock. */
+static void
+write_map_sector (size_t i)
+{
+  size_t start = i * BITS_PER_SECTOR;
+  size_t cnt = bitmap_size (free_map) - start;
+
+  if (cnt > BITS_PER_SECTOR)
+    cnt = BITS_PER_SECTOR;
+  if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+    PANIC ("can't write free map");
+  bitmap_reset (dirty_map, i);
+  bitmap_reset (lazy_map, i);
+  write_cnt++;
+}
 
 /** Initializes the free map. */
 void
@@ -17,36 +93,154 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_set_multiple (free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_size (free_map),
+                                           BITS_PER_SECTOR));
+  lazy_map = bitmap_create (bitmap_size (dirty_map));
+  released_map = bitmap_create (bitmap_size (free_map));
+  committed_map = bitmap_create (bitmap_size (free_map));
+  if (dirty_map == NULL || lazy_map == NULL
+      || released_map == NULL || committed_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  lock_init (&free_map_lock);
 }
 
 /** Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/** Like free_map_allocate(), but takes the first run of CNT free
+   sectors at or after HINT if there is one, so that data written
+   together stays together on disk.  If there is none, but
+   committed releases are waiting on a checkpoint, checkpoints the
+   journal and tries again. */
+bool
+free_map_allocate_near (block_sector_t hint, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  block_sector_t sector = BITMAP_ERROR;
+  bool retry = true;
+
+  lock_acquire (&free_map_lock);
+  for (;;)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      if (hint < bitmap_size (free_map))
+        sector = bitmap_scan_and_flip (free_map, hint, cnt, false);
+      if (sector == BITMAP_ERROR && hint > 0)
+        sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+      if (sector != BITMAP_ERROR || !retry
+          || bitmap_none (committed_map, 0, bitmap_size (committed_map)))
+        break;
+
+      lock_release (&free_map_lock);
+      journal_checkpoint ();
+      lock_acquire (&free_map_lock);
+      retry = false;
     }
+  if (sector != BITMAP_ERROR)
+    mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
-/** Makes CNT sectors starting at SECTOR available for use. */
+/** Makes CNT sectors starting at SECTOR available for use, once
+   the journal has committed the running transaction and then
+   checkpointed. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
-  bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  ASSERT (bitmap_none (released_map, sector, cnt));
+  bitmap_set_multiple (released_map, sector, cnt, true);
+  lock_release (&free_map_lock);
+}
+
+/** Called by the journal once it has committed a transaction:
+   sectors released so far become free at the next checkpoint. */
+void
+free_map_commit (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < bitmap_size (released_map); i++)
+    if (bitmap_test (released_map, i))
+      {
+        bitmap_mark (committed_map, i);
+        bitmap_reset (released_map, i);
+      }
+  lock_release (&free_map_lock);
+}
+
+/** Called by the journal once it has checkpointed: frees the
+   sectors released by committed transactions. */
+void
+free_map_checkpoint (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  for (i = 0; i < bitmap_size (committed_map); i++)
+    if (bitmap_test (committed_map, i))
+      {
+        bitmap_reset (free_map, i);
+        bitmap_reset (committed_map, i);
+        mark_lazy (i);
+      }
+  lock_release (&free_map_lock);
+}
+
+/** Writes the sectors of the free map that operations have
+   changed since they were last written to the free map file,
+   through the journal, and then up to ROOM of the sectors that
+   checkpoints have changed.  Does nothing before the file is
+   open. */
+void
+free_map_flush (size_t room)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    {
+      for (i = 0; i < bitmap_size (dirty_map); i++)
+        if (bitmap_test (dirty_map, i))
+          write_map_sector (i);
+      for (i = 0; i < bitmap_size (lazy_map) && room > 0; i++)
+        if (bitmap_test (lazy_map, i))
+          {
+            write_map_sector (i);
+            room--;
+          }
+    }
+  lock_release (&free_map_lock);
+}
+
+/** Returns true if the free map file, once the journal commits,
+   holds every change to the free map, including the releases
+   still waiting on a commit or checkpoint. */
+bool
+free_map_synced (void)
+{
+  bool synced;
+
+  lock_acquire (&free_map_lock);
+  synced = (bitmap_none (dirty_map, 0, bitmap_size (dirty_map))
+            && bitmap_none (lazy_map, 0, bitmap_size (lazy_map))
+            && bitmap_none (released_map, 0, bitmap_size (released_map))
+            && bitmap_none (committed_map, 0,
+                            bitmap_size (committed_map)));
+  lock_release (&free_map_lock);
+  return synced;
 }
 
 /** Opens the free map file and reads it from disk. */
@@ -60,11 +254,13 @@ free_map_open (void)
     PANIC ("can't read free map");
 }
 
-/** Writes the free map to disk and closes the free map file. */
+/** Closes the free map file.  The journal must already have been
+   flushed, to write the free map to disk. */
 void
 free_map_close (void) 
 {
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /** Creates a new free map file on disk and writes the free map to
@@ -73,13 +269,24 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  journal_begin (1);
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), true))
     PANIC ("free map creation failed");
+  journal_end ();
 
-  /* Write bitmap to file. */
+  /* Write bitmap to file.  The new file is a hole, so writing it
+     allocates its sectors, whose bits are written at the next
+     flush.  A large free map takes more than one operation. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
 }
+
+/** Prints free map statistics. */
+void
+free_map_print_stats (void)
+{
+  printf ("Free map: %lld sectors written\n", write_cnt);
+}
@@ -1,25 +1,61 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /** Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/** Sector pointers in an inode and in an index sector.  A file
+   of MAX_SECTORS sectors, a little over 8 MB, is the largest an
+   inode can index.  A zero pointer means "not allocated": sector 0
+   holds the free map's inode and is never file data. */
+#define DIRECT_CNT 123
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
+/** Bytes of data an inode can hold in place of its sector
+   pointers. */
+#define INLINE_SIZE ((DIRECT_CNT + 2) * sizeof (block_sector_t))
+
+/** Inode flags. */
+#define INODE_INLINE 0x1                /**< Data is in the inode itself. */
+#define INODE_META 0x2                  /**< Data is file system metadata. */
+
 /** On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   A file no bigger than INLINE_SIZE bytes keeps its data in the
+   inode sector instead of in data sectors, so that reading it
+   takes no disk access beyond the one that opened it. */
 struct inode_disk
   {
-    block_sector_t start;               /**< First data sector. */
     off_t length;                       /**< File size in bytes. */
     unsigned magic;                     /**< Magic number. */
-    uint32_t unused[125];               /**< Not used. */
+    unsigned flags;                     /**< INODE_* flags. */
+    union
+      {
+        struct
+          {
+            block_sector_t direct[DIRECT_CNT]; /**< Data sectors. */
+            block_sector_t indirect;    /**< Sector of data sector pointers. */
+            block_sector_t doubly_indirect; /**< Sector of indirect pointers. */
+          };
+        uint8_t inline_data[INLINE_SIZE]; /**< Data, if INODE_INLINE. */
+      };
   };
 
+/** A sector of zeros. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
 /** Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -31,46 +67,334 @@ bytes_to_sectors (off_t size)
 /** In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /**< Element in inode list. */
+    struct hash_elem elem;              /**< Element in open_inodes. */
     block_sector_t sector;              /**< Sector number of disk location. */
     int open_cnt;                       /**< Number of openers. */
     bool removed;                       /**< True if deleted, false otherwise. */
+    bool loading;                       /**< Being read by inode_open()? */
+    struct condition loaded;            /**< Signaled when LOADING clears. */
     int deny_write_cnt;                 /**< 0: writes ok, >0: deny writes. */
+    struct lock lock;                   /**< See inode_lock(). */
+    struct rwlock rw;                   /**< Guards DATA and DENY_WRITE_CNT.
+                                           Held shared to read or write
+                                           in place and exclusively to
+                                           allocate or extend. */
     struct inode_disk data;             /**< Inode content. */
   };
 
+/** Writes SIZE bytes from BUFFER at offset OFS within SECTOR, a
+   data sector of the file whose inode is D.  The data of a file
+   that holds metadata goes through the journal. */
+static void
+data_write_at (const struct inode_disk *d, block_sector_t sector,
+               const void *buffer, int ofs, int size)
+{
+  if (d->flags & INODE_META)
+    cache_log_write_at (sector, buffer, ofs, size);
+  else
+    cache_write_at (sector, buffer, ofs, size);
+}
+
+/** Returns pointer IDX in index sector SECTOR. */
+static block_sector_t
+read_ptr (block_sector_t sector, size_t idx)
+{
+  block_sector_t ptr;
+  cache_read_at (sector, &ptr, idx * sizeof ptr, sizeof ptr);
+  return ptr;
+}
+
+/** Sets pointer IDX in index sector SECTOR to PTR. */
+static void
+write_ptr (block_sector_t sector, size_t idx, block_sector_t ptr)
+{
+  cache_log_write_at (sector, &ptr, idx * sizeof ptr, sizeof ptr);
+}
+
+/** Returns the sector holding data sector IDX of the file whose
+   inode is D, or 0 if none is allocated. */
+static block_sector_t
+index_lookup (const struct inode_disk *d, size_t idx)
+{
+  block_sector_t indirect;
+
+  if (idx < DIRECT_CNT)
+    return d->direct[idx];
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    return d->indirect != 0 ? read_ptr (d->indirect, idx) : 0;
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR && d->doubly_indirect != 0)
+    {
+      indirect = read_ptr (d->doubly_indirect, idx / PTRS_PER_SECTOR);
+      if (indirect != 0)
+        return read_ptr (indirect, idx % PTRS_PER_SECTOR);
+    }
+  return 0;
+}
+
+/** Allocates a zeroed index sector near HINT and stores it in
+   *SECTORP, unless *SECTORP already names one. */
+static bool
+index_alloc (block_sector_t *sectorp, block_sector_t hint)
+{
+  if (*sectorp != 0)
+    return true;
+  if (!free_map_allocate_near (hint, 1, sectorp))
+    return false;
+  cache_log_write (*sectorp, zeros);
+  return true;
+}
+
+/** Records SECTOR as data sector IDX of the file whose inode is D,
+   allocating index sectors as needed.  Modifies D itself for the
+   direct and top-level pointers; the caller writes D out. */
+static bool
+index_set (struct inode_disk *d, size_t idx, block_sector_t sector)
+{
+  block_sector_t indirect;
+
+  if (idx < DIRECT_CNT)
+    {
+      d->direct[idx] = sector;
+      return true;
+    }
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    {
+      if (!index_alloc (&d->indirect, sector))
+        return false;
+      write_ptr (d->indirect, idx, sector);
+      return true;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (idx < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      if (!index_alloc (&d->doubly_indirect, sector))
+        return false;
+      indirect = read_ptr (d->doubly_indirect, idx / PTRS_PER_SECTOR);
+      if (indirect == 0)
+        {
+          if (!index_alloc (&indirect, sector))
+            return false;
+          write_ptr (d->doubly_indirect, idx / PTRS_PER_SECTOR, indirect);
+        }
+      write_ptr (indirect, idx % PTRS_PER_SECTOR, sector);
+      return true;
+    }
+  return false;
+}
+
+/** Journal credits that allocating one run of data sectors may
+   use, besides those for logging the data of a metadata file:
+   up to two free map sectors for the run, one each for a new
+   indirect and doubly indirect sector and the index sectors that
+   point to them, and the inode itself. */
+#define RUN_CREDITS (INODE_GROW_CREDITS - 1)
+
+/** Journal credits for a write that changes metadata: one run of
+   allocation, plus the free map and data sectors for moving
+   inline data out. */
+#define WRITE_CREDITS (INODE_GROW_CREDITS + 2)
+
+/** Returns the number of data sectors from IDX up to the next
+   point where a different index sector takes over. */
+static size_t
+index_span (size_t idx)
+{
+  if (idx < DIRECT_CNT)
+    return DIRECT_CNT - idx;
+  return PTRS_PER_SECTOR - (idx - DIRECT_CNT) % PTRS_PER_SECTOR;
+}
+
+/** Allocates and zeroes every missing data sector of the file whose
+   inode is D that holds a byte between START and END (exclusive).
+   Takes runs of contiguous sectors, placed just after the
+   preceding sector where possible, so that sequential access
+   stays sequential.  Does not change D's length.  Stops early,
+   leaving the later sectors missing, once the running journal
+   operation lacks the credits for another run; that is not a
+   failure.  Returns false if a sector could not be allocated, in
+   which case some sectors may have been allocated anyway; they
+   are released with the rest of the file. */
+static bool
+inode_allocate (struct inode_disk *d, off_t start, off_t end)
+{
+  size_t idx = start / BLOCK_SECTOR_SIZE;
+  size_t end_idx = bytes_to_sectors (end);
+  block_sector_t hint = idx > 0 ? index_lookup (d, idx - 1) + 1 : 0;
+
+  if (end_idx > MAX_SECTORS)
+    return false;
+
+  while (idx < end_idx)
+    {
+      block_sector_t first;
+      size_t credits = journal_credits ();
+      size_t cnt, max_cnt, i;
+
+      /* Count the run of missing sectors starting at IDX, up to
+         the end of its index sector and, for a metadata file, as
+         many as the credits left can log. */
+      if (index_lookup (d, idx) != 0)
+        {
+          idx++;
+          continue;
+        }
+      if (credits < RUN_CREDITS + ((d->flags & INODE_META) != 0))
+        return true;
+      max_cnt = index_span (idx);
+      if ((d->flags & INODE_META) && max_cnt > credits - RUN_CREDITS)
+        max_cnt = credits - RUN_CREDITS;
+      for (cnt = 1; cnt < max_cnt && idx + cnt < end_idx; cnt++)
+        if (index_lookup (d, idx + cnt) != 0)
+          break;
+
+      /* Take as long a contiguous run as the free map has. */
+      while (!free_map_allocate_near (hint, cnt, &first))
+        if ((cnt /= 2) == 0)
+          return false;
+
+      for (i = 0; i < cnt; i++)
+        {
+          data_write_at (d, first + i, zeros, 0, BLOCK_SECTOR_SIZE);
+          if (!index_set (d, idx + i, first + i))
+            {
+              free_map_release (first + i, cnt - i);
+              return false;
+            }
+        }
+      idx += cnt;
+      hint = first + cnt;
+    }
+  return true;
+}
+
+/** Releases SECTOR, and if LEVEL is greater than 0, every sector it
+   points to, recursively to depth LEVEL.  Does nothing if SECTOR
+   is 0. */
+static void
+release_tree (block_sector_t sector, int level)
+{
+  size_t i;
+
+  if (sector == 0)
+    return;
+  if (level > 0)
+    for (i = 0; i < PTRS_PER_SECTOR; i++)
+      release_tree (read_ptr (sector, i), level - 1);
+  free_map_release (sector, 1);
+}
+
+/** Releases all the data and index sectors of the file whose inode
+   is D. */
+static void
+inode_deallocate (struct inode_disk *d)
+{
+  size_t i;
+
+  if (d->flags & INODE_INLINE)
+    return;
+  for (i = 0; i < DIRECT_CNT; i++)
+    release_tree (d->direct[i], 0);
+  release_tree (d->indirect, 1);
+  release_tree (d->doubly_indirect, 2);
+}
+
+/** Moves the inline data of INODE, which must be inline, out to a
+   data sector of its own so that the file can grow past
+   INLINE_SIZE bytes.  The caller must hold INODE's rw lock for
+   writing.
+   Returns false if no sector is free. */
+static bool
+inode_spill (struct inode *inode)
+{
+  struct inode_disk *d = &inode->data;
+  block_sector_t sector = 0;
+
+  ASSERT (d->flags & INODE_INLINE);
+  ASSERT (rwlock_held_for_write (&inode->rw));
+
+  if (d->length > 0)
+    {
+      if (!free_map_allocate_near (inode->sector + 1, 1, &sector))
+        return false;
+      data_write_at (d, sector, zeros, 0, BLOCK_SECTOR_SIZE);
+      data_write_at (d, sector, d->inline_data, 0, d->length);
+    }
+
+  memset (d->inline_data, 0, sizeof d->inline_data);
+  d->flags &= ~INODE_INLINE;
+  d->direct[0] = sector;
+  cache_log_write (inode->sector, d);
+  return true;
+}
+
 /** Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
+   Returns 0 if POS lies in a hole that has never been written,
+   or -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return index_lookup (&inode->data, pos / BLOCK_SECTOR_SIZE);
   else
     return -1;
 }
 
-/** List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/** Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  OPEN_INODES_LOCK
+   protects the table and the OPEN_CNT and LOADING of every
+   inode in it. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+
+/** Statistics. */
+static long long open_hit_cnt;      /**< # of opens of an open inode. */
+static long long open_miss_cnt;     /**< # of opens that read an inode. */
+
+/** Returns a hash of the sector of inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/** Orders inodes by sector. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
 
 /** Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("inode: hash table creation failed");
+  lock_init (&open_inodes_lock);
 }
 
 /** Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data starts out as a hole: no sectors are
+   allocated until they are first written, and until then the
+   file reads back as zeros.  A file small enough starts out
+   inline, with its data in the inode itself.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool meta)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -84,20 +408,15 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      if (length <= (off_t) INLINE_SIZE)
+        disk_inode->flags |= INODE_INLINE;
+      if (meta)
+        disk_inode->flags |= INODE_META;
+      if (bytes_to_sectors (length) <= MAX_SECTORS) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          cache_log_write (sector, disk_inode);
           success = true; 
         } 
       free (disk_inode);
@@ -111,33 +430,57 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      /* If another opener is still reading it, wait. */
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      open_hit_cnt++;
+      while (inode->loading)
+        cond_wait (&inode->loaded, &open_inodes_lock);
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize, and enter the inode into the table marked as
+     loading before reading it, so that opens of other inodes
+     need not wait for the read and opens of this one wait on
+     LOADED instead of reading it again. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->loading = true;
+  cond_init (&inode->loaded);
+  lock_init (&inode->lock);
+  rwlock_init (&inode->rw);
+  hash_insert (&open_inodes, &inode->elem);
+  open_miss_cnt++;
+  lock_release (&open_inodes_lock);
+
+  cache_read (inode->sector, &inode->data);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -146,7 +489,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -163,22 +510,28 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          journal_begin (0);
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          inode_deallocate (&inode->data);
+          journal_end ();
         }
 
       free (inode); 
@@ -194,15 +547,53 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/** Brings the sectors of INODE that hold bytes START through END
+   (exclusive), at most CACHE_RUN_MAX of them, into the cache all
+   at once.  The caller must hold INODE's rwlock. */
+static void
+inode_fill (struct inode *inode, off_t start, off_t end)
+{
+  block_sector_t sectors[CACHE_RUN_MAX];
+  size_t cnt = 0;
+  off_t ofs;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  for (ofs = start - start % BLOCK_SECTOR_SIZE; ofs < end;
+       ofs += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, ofs);
+      if (sector != 0)
+        sectors[cnt++] = sector;
+    }
+  cache_fill (sectors, cnt);
+}
+
 /** Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.  A read
+   of several sectors brings them in CACHE_RUN_MAX at a time. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t filled = 0;
+
+  rwlock_acquire_read (&inode->rw);
+  if (inode->data.flags & INODE_INLINE)
+    {
+      /* Inline data is already in memory. */
+      if (offset < inode->data.length)
+        {
+          bytes_read = inode->data.length - offset;
+          if (bytes_read > size)
+            bytes_read = size;
+          memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+        }
+      rwlock_release_read (&inode->rw);
+      return bytes_read;
+    }
 
   while (size > 0) 
     {
@@ -220,59 +611,158 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (offset >= filled && size > sector_left)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          filled = offset - sector_ofs + CACHE_RUN_MAX * BLOCK_SECTOR_SIZE;
+          inode_fill (inode, offset,
+                      filled < offset + size ? filled : offset + size);
         }
+
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+      else
+        memset (buffer + bytes_read, 0, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
-/** Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+/** Queues the sectors of INODE that hold bytes START through END
+   (exclusive) to be read into the cache in the background. */
+void
+inode_read_ahead (struct inode *inode, off_t start, off_t end)
+{
+  off_t ofs;
+
+  rwlock_acquire_read (&inode->rw);
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  if (!(inode->data.flags & INODE_INLINE))
+    for (ofs = start - start % BLOCK_SECTOR_SIZE; ofs < end;
+         ofs += BLOCK_SECTOR_SIZE)
+      {
+        block_sector_t sector = byte_to_sector (inode, ofs);
+        if (sector != 0)
+          cache_read_ahead (sector);
+      }
+  rwlock_release_read (&inode->rw);
+}
+
+/** Returns the offset of the first sector-aligned block of INODE,
+   at or after POS rounded down to a sector, that is not a hole,
+   or -1 if every block from there to the end of INODE is. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+inode_next_data (struct inode *inode, off_t pos)
+{
+  off_t length, ofs = -1;
+  size_t idx;
+
+  rwlock_acquire_read (&inode->rw);
+  length = inode_length (inode);
+  if (inode->data.flags & INODE_INLINE)
+    {
+      if (pos < length)
+        ofs = pos - pos % BLOCK_SECTOR_SIZE;
+    }
+  else
+    for (idx = pos / BLOCK_SECTOR_SIZE; idx < bytes_to_sectors (length);
+         idx++)
+      if (index_lookup (&inode->data, idx) != 0)
+        {
+          ofs = (off_t) idx * BLOCK_SECTOR_SIZE;
+          break;
+        }
+  rwlock_release_read (&inode->rw);
+  return ofs;
+}
+
+/** Writes up to SIZE bytes from BUFFER into INODE, starting at
+   OFFSET, within a single journal operation if it changes
+   metadata.  Returns the number of bytes written, which is less
+   than SIZE if the operation runs short of journal credits for
+   the sectors to allocate, the disk fills up, or an error
+   occurs.  Sets *MORE to true only in the first case, when
+   another operation may write the rest. */
+static off_t
+write_some (struct inode *inode, const uint8_t *buffer, off_t size,
+            off_t offset, bool *more)
 {
-  const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool exclusive;
+  bool allocated = false;
+  bool alloc_ok = true;
+  off_t end;
+
+  *more = false;
+
+  /* Writes within the file's sectors share the inode; the buffer
+     cache keeps each sector consistent.  A write that may extend
+     the file or move its inline data out needs it to itself, and
+     changes metadata, so it is a journal operation. */
+  exclusive = (offset + size > inode_length (inode)
+               || (inode->data.flags & INODE_INLINE));
+  if (exclusive)
+    {
+      journal_begin (WRITE_CREDITS);
+      rwlock_acquire_write (&inode->rw);
+    }
+  else
+    rwlock_acquire_read (&inode->rw);
 
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      if (exclusive)
+        {
+          rwlock_release_write (&inode->rw);
+          journal_end ();
+        }
+      else
+        rwlock_release_read (&inode->rw);
+      return 0;
+    }
+
+  if (inode->data.flags & INODE_INLINE)
+    {
+      /* Inline data is written in place.  A write that would not
+         fit moves the data out to a sector first. */
+      if (offset + size <= (off_t) INLINE_SIZE)
+        {
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          if (offset + size > inode->data.length)
+            inode->data.length = offset + size;
+          cache_log_write (inode->sector, &inode->data);
+          rwlock_release_write (&inode->rw);
+          journal_end ();
+          return size;
+        }
+      if (!inode_spill (inode))
+        {
+          rwlock_release_write (&inode->rw);
+          journal_end ();
+          return 0;
+        }
+    }
+
+  end = inode_length (inode);
+  if (offset + size > end)
+    end = offset + size;
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = index_lookup (&inode->data,
+                                                offset / BLOCK_SECTOR_SIZE);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = end - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -281,49 +771,99 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
+      if (sector_idx == 0 && !allocated)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          /* First write into a hole.  Allocate every sector the
+             rest of the write needs at once, so that they can be
+             contiguous.  Sectors that cannot be allocated cut the
+             write short.  Another writer may fill the hole while
+             we trade a shared hold for an exclusive one, which
+             inode_allocate() copes with, and writes may be denied
+             meanwhile, which ends the write here. */
+          if (!exclusive)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              rwlock_release_read (&inode->rw);
+              journal_begin (WRITE_CREDITS);
+              rwlock_acquire_write (&inode->rw);
+              exclusive = true;
+              if (inode->deny_write_cnt)
+                {
+                  rwlock_release_write (&inode->rw);
+                  journal_end ();
+                  return bytes_written;
+                }
             }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          alloc_ok = inode_allocate (&inode->data, offset, offset + size);
+          allocated = true;
+          sector_idx = index_lookup (&inode->data,
+                                     offset / BLOCK_SECTOR_SIZE);
         }
+      if (sector_idx == 0)
+        break;
+
+      data_write_at (&inode->data, sector_idx, buffer + bytes_written,
+                     sector_ofs, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+  *more = size > 0 && allocated && alloc_ok;
+
+  if (exclusive)
+    {
+      if (offset > inode->data.length)
+        inode->data.length = offset;
+      cache_log_write (inode->sector, &inode->data);
+      rwlock_release_write (&inode->rw);
+      journal_end ();
+    }
+  else
+    rwlock_release_read (&inode->rw);
 
   return bytes_written;
 }
 
+/** Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if the disk fills up or an error occurs.
+   A write past end of file extends the inode.  The new length
+   becomes visible only once the data is written, so a
+   concurrent reader never sees the gap filled in early.  Only
+   the sectors actually written are allocated; any gap between
+   the old end of file and OFFSET is left as a hole.  A large
+   write into a hole takes several journal operations, each of
+   which extends the file by what it wrote. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+                off_t offset) 
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+  bool more = true;
+
+  while (bytes_written < size && more)
+    {
+      off_t chunk = write_some (inode, buffer + bytes_written,
+                                size - bytes_written,
+                                offset + bytes_written, &more);
+      if (chunk == 0)
+        break;
+      bytes_written += chunk;
+    }
+  return bytes_written;
+}
+
 /** Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rw);
 }
 
 /** Re-enables writes to INODE.
@@ -332,9 +872,49 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rw);
+}
+
+/** Acquires INODE's lock, which callers use to make a sequence of
+   reads and writes of INODE atomic, as the directory code does
+   for lookups and updates.  It does not exclude plain
+   inode_read_at() and inode_write_at() calls, so every party to
+   such a sequence must take it. */
+void
+inode_lock (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+}
+
+/** Releases INODE's lock. */
+void
+inode_unlock (struct inode *inode)
+{
+  lock_release (&inode->lock);
+}
+
+/** Writes INODE's data back to disk, then commits the journal,
+   so that INODE's contents and metadata as they were at the call
+   survive a crash. */
+void
+inode_sync (struct inode *inode)
+{
+  off_t ofs;
+
+  rwlock_acquire_read (&inode->rw);
+  if (!(inode->data.flags & INODE_INLINE))
+    for (ofs = 0; ofs < inode->data.length; ofs += BLOCK_SECTOR_SIZE)
+      {
+        block_sector_t sector = byte_to_sector (inode, ofs);
+        if (sector != 0)
+          cache_sync (sector);
+      }
+  rwlock_release_read (&inode->rw);
+  journal_commit ();
 }
 
 /** Returns the length, in bytes, of INODE's data. */
@@ -343,3 +923,11 @@ inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/** Prints inode statistics. */
+void
+inode_print_stats (void)
+{
+  printf ("Inode: %lld opens of open inodes, %lld opens from disk\n",
+          open_hit_cnt, open_miss_cnt);
+}
@@ -0,0 +1,414 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/** Metadata journal.
+
+   Inodes, index sectors, directories, and the free map are
+   written through the journal; file data is not.  Each change to
+   the file system's metadata happens within an operation,
+   bracketed by journal_begin() and journal_end().  The sectors an
+   operation writes with cache_log_write() stay in the buffer
+   cache, marked as part of the running transaction, which
+   collects the sectors of every operation since the last commit.
+
+   A commit waits for the operations in progress to end, then
+   writes a descriptor naming the transaction's sectors and a copy
+   of each, in a single sequential write, followed by a commit
+   record, into the log, the JOURNAL_SECTORS sectors starting at
+   JOURNAL_SECTOR.  From then
+   on the sectors are ordinary dirty cache entries that reach
+   their home locations whenever the cache writes them back.
+
+   A checkpoint writes the whole cache back and then empties the
+   log by advancing the sequence number in the log's first
+   sector, which names the first transaction the log holds.  It
+   happens when the log fills up and periodically from the
+   flusher thread.  At mount, journal_init() replays every
+   complete transaction in the log, in order, so that an
+   operation's metadata changes reach the disk all together or
+   not at all.
+
+   Sectors released by an operation stay allocated until the
+   next checkpoint, so that replay can never overwrite a sector
+   that has since been reused for file data.
+
+   A transaction must fit in the log, and its sectors stay pinned
+   in the cache until it commits, so it may hold at most TXN_MAX
+   of them.  To guarantee that, each operation tells
+   journal_begin() the most sectors it can add, its credits, and
+   waits until the running transaction has that much room to
+   spare; each sector the operation adds uses up one credit.
+   Operations reserve only what they may need, so that several
+   can run at once.  One that might need more, such as a large
+   write into a hole, checks journal_credits() as it goes and
+   stops early, leaving the rest to an operation of its own. */
+
+/** Commit once the running transaction has this many sectors. */
+#define TXN_COMMIT 16
+
+/** Most sectors a transaction may hold, including what operations
+   in progress add after it reaches TXN_COMMIT.  Half the buffer
+   cache, so that pinned sectors never crowd out the rest. */
+#define TXN_MAX 32
+
+/** Most credits one operation may reserve, so that it can always
+   be admitted to a transaction that has not yet reached
+   TXN_COMMIT. */
+#define OP_CREDITS_MAX (TXN_MAX - TXN_COMMIT)
+
+/** Log records. */
+#define SUPER_MAGIC 0x4a524e4c          /**< "JRNL": log header. */
+#define DESC_MAGIC 0x44455343           /**< "DESC": transaction start. */
+#define COMMIT_MAGIC 0x434d4954         /**< "CMIT": transaction end. */
+
+/** A log record, one sector long. */
+struct journal_block
+  {
+    unsigned magic;                     /**< One of the *_MAGIC values. */
+    unsigned seq;                       /**< Transaction sequence number. */
+    unsigned cnt;                       /**< Number of SECTORS. */
+    block_sector_t sectors[125];        /**< Home sectors, in a descriptor. */
+  };
+
+static struct lock journal_lock;        /**< Protects the members below. */
+static struct condition journal_cond;   /**< Signaled when they change. */
+static unsigned active_cnt;             /**< Operations in progress. */
+static bool committing;                 /**< A commit is waiting or writing. */
+static block_sector_t txn[TXN_MAX];     /**< Running transaction's sectors. */
+static size_t txn_cnt;                  /**< Number of sectors in TXN. */
+static size_t reserved;                 /**< Unused credits of operations. */
+static size_t fm_pending;               /**< Free map sectors to log. */
+
+static struct lock log_lock;            /**< Serializes writes to the log. */
+static unsigned next_seq;               /**< Sequence number of next commit. */
+static size_t log_head;                 /**< Next free log sector. */
+static uint8_t buffer[BLOCK_SECTOR_SIZE]; /**< Sector copied into the log. */
+
+/** A transaction's descriptor followed by a copy of each of its
+   sectors, staged so that they reach the log in a single write. */
+static uint8_t log_buf[(TXN_MAX + 1) * BLOCK_SECTOR_SIZE];
+
+/** Statistics. */
+static long long commit_cnt;            /**< # of transactions committed. */
+static long long logged_cnt;            /**< # of sectors written to the log. */
+static long long checkpoint_cnt;        /**< # of checkpoints. */
+static long long replay_cnt;            /**< # of sectors replayed at mount. */
+
+static void write_super (void);
+static void replay (void);
+static void checkpoint (void);
+
+/** Initializes the journal.  If FORMAT is true, creates an empty
+   log; otherwise replays the log left by the last mount. */
+void
+journal_init (bool format)
+{
+  ASSERT (sizeof (struct journal_block) == BLOCK_SECTOR_SIZE);
+
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+  lock_init (&log_lock);
+
+  if (format)
+    next_seq = 1;
+  else
+    replay ();
+  write_super ();
+}
+
+/** Begins an operation.  The metadata the operation writes is
+   committed to disk together.  Operations nest: only the
+   outermost one a thread begins counts, and the nested ones
+   share its CREDITS, the most sectors the operation may add.
+   Must not be called while holding any file system lock, since
+   it may wait for a commit. */
+void
+journal_begin (size_t credits)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_depth++ > 0)
+    return;
+
+  ASSERT (credits <= OP_CREDITS_MAX);
+  lock_acquire (&journal_lock);
+  while (committing || txn_cnt + fm_pending >= TXN_COMMIT
+         || txn_cnt + fm_pending + reserved + credits > TXN_MAX)
+    cond_wait (&journal_cond, &journal_lock);
+  active_cnt++;
+  reserved += credits;
+  t->journal_credits = credits;
+  lock_release (&journal_lock);
+}
+
+/** Ends an operation begun with journal_begin().  The last
+   operation to end commits the transaction if it is big enough. */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+  bool commit;
+
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  active_cnt--;
+  reserved -= t->journal_credits;
+  t->journal_credits = 0;
+  commit = active_cnt == 0 && txn_cnt + fm_pending >= TXN_COMMIT;
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+
+  if (commit)
+    journal_commit ();
+}
+
+/** Returns true if the running thread is within an operation. */
+bool
+journal_active (void)
+{
+  return thread_current ()->journal_depth > 0;
+}
+
+/** Returns the number of sectors the running thread's operation
+   may still add to the transaction. */
+size_t
+journal_credits (void)
+{
+  return thread_current ()->journal_credits;
+}
+
+/** Uses up one of the running operation's credits, if it has any
+   left.  The caller must hold journal_lock. */
+static void
+use_credit (void)
+{
+  struct thread *t = thread_current ();
+
+  if (t->journal_credits > 0)
+    {
+      t->journal_credits--;
+      reserved--;
+    }
+}
+
+/** Adds SECTOR to the running transaction.  Called by the buffer
+   cache the first time an operation writes SECTOR through the
+   journal since the last commit. */
+void
+journal_log (block_sector_t sector)
+{
+  ASSERT (journal_active ());
+
+  lock_acquire (&journal_lock);
+  ASSERT (txn_cnt + fm_pending < TXN_MAX);
+  txn[txn_cnt++] = sector;
+  use_credit ();
+  lock_release (&journal_lock);
+}
+
+/** Charges the running operation for a sector of the free map
+   that its allocations changed, which the next commit will add
+   to the transaction. */
+void
+journal_charge (void)
+{
+  ASSERT (journal_active ());
+
+  lock_acquire (&journal_lock);
+  ASSERT (txn_cnt + fm_pending < TXN_MAX);
+  fm_pending++;
+  use_credit ();
+  lock_release (&journal_lock);
+}
+
+/** Commits the running transaction, waiting for the operations in
+   progress to end first.  The free map's pending changes are
+   written as part of it. */
+void
+journal_commit (void)
+{
+  struct thread *t = thread_current ();
+  size_t room;
+  size_t i;
+
+  ASSERT (t->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&journal_cond, &journal_lock);
+  committing = true;
+  while (active_cnt > 0)
+    cond_wait (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+
+  /* Log the free map as though within an operation, along with
+     as many of its lazily written sectors as fit.  The sectors
+     operations were charged for join the transaction here. */
+  room = TXN_MAX - txn_cnt - fm_pending;
+  fm_pending = 0;
+  t->journal_depth++;
+  free_map_flush (room);
+  t->journal_depth--;
+
+  if (txn_cnt > 0)
+    {
+      struct journal_block *b = (struct journal_block *) log_buf;
+
+      lock_acquire (&log_lock);
+      if (log_head + txn_cnt + 2 > JOURNAL_SECTORS)
+        checkpoint ();
+
+      /* Descriptor and sector contents, in one sequential write. */
+      memset (b, 0, sizeof *b);
+      b->magic = DESC_MAGIC;
+      b->seq = next_seq;
+      b->cnt = txn_cnt;
+      memcpy (b->sectors, txn, txn_cnt * sizeof *txn);
+      for (i = 0; i < txn_cnt; i++)
+        cache_read (txn[i], log_buf + (i + 1) * BLOCK_SECTOR_SIZE);
+      block_write_multiple (fs_device, JOURNAL_SECTOR + log_head,
+                            txn_cnt + 1, log_buf);
+      log_head += txn_cnt + 1;
+
+      /* Commit record, written only after the rest is on disk.
+         Once it is there too, the transaction will survive a
+         crash. */
+      b = (struct journal_block *) buffer;
+      memset (b, 0, sizeof *b);
+      b->magic = COMMIT_MAGIC;
+      b->seq = next_seq++;
+      block_write (fs_device, JOURNAL_SECTOR + log_head++, b);
+      lock_release (&log_lock);
+
+      for (i = 0; i < txn_cnt; i++)
+        cache_unlog (txn[i]);
+      free_map_commit ();
+      commit_cnt++;
+      logged_cnt += txn_cnt;
+      txn_cnt = 0;
+    }
+
+  lock_acquire (&journal_lock);
+  committing = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/** Writes every committed change to its home location and
+   empties the log.  May be called within an operation. */
+void
+journal_checkpoint (void)
+{
+  lock_acquire (&log_lock);
+  checkpoint ();
+  lock_release (&log_lock);
+}
+
+/** Commits and checkpoints until the disk holds every change and
+   the log is empty.  This takes at least two rounds, since the
+   sectors that the first round makes free again are recorded in
+   the free map by the second, and more if the free map has more
+   changed sectors than one transaction holds.  Meant for when the
+   file system is otherwise idle. */
+void
+journal_flush (void)
+{
+  do
+    {
+      journal_commit ();
+      journal_checkpoint ();
+    }
+  while (!free_map_synced ());
+}
+
+/** Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  printf ("Journal: %lld commits, %lld sectors logged, %lld checkpoints, "
+          "%lld sectors replayed\n",
+          commit_cnt, logged_cnt, checkpoint_cnt, replay_cnt);
+}
+
+/** Empties the log, once the cache has written back everything
+   it holds from committed transactions.  Sectors of the running
+   transaction stay in the cache; any earlier committed version
+   of them was written back when they joined it.  The caller must
+   hold log_lock. */
+static void
+checkpoint (void)
+{
+  ASSERT (lock_held_by_current_thread (&log_lock));
+
+  cache_flush ();
+  write_super ();
+  free_map_checkpoint ();
+  checkpoint_cnt++;
+}
+
+/** Writes the log header, making the log empty. */
+static void
+write_super (void)
+{
+  struct journal_block *b = (struct journal_block *) buffer;
+
+  memset (b, 0, sizeof *b);
+  b->magic = SUPER_MAGIC;
+  b->seq = next_seq;
+  block_write (fs_device, JOURNAL_SECTOR, b);
+  log_head = 1;
+}
+
+/** Reads the log header and record at log sector OFS into B.
+   Returns true if B is a record of type MAGIC for transaction
+   SEQ. */
+static bool
+read_record (size_t ofs, unsigned magic, unsigned seq,
+             struct journal_block *b)
+{
+  if (ofs >= JOURNAL_SECTORS)
+    return false;
+  block_read (fs_device, JOURNAL_SECTOR + ofs, b);
+  return b->magic == magic && b->seq == seq;
+}
+
+/** Copies every complete transaction in the log to the sectors
+   it names, in the order they were committed, and sets next_seq
+   past the last one. */
+static void
+replay (void)
+{
+  static struct journal_block desc;
+  struct journal_block *b = (struct journal_block *) buffer;
+  size_t ofs = 1;
+  size_t i;
+
+  block_read (fs_device, JOURNAL_SECTOR, b);
+  if (b->magic != SUPER_MAGIC)
+    PANIC ("journal: no log found; reformat the file system");
+  next_seq = b->seq;
+
+  while (read_record (ofs, DESC_MAGIC, next_seq, &desc)
+         && desc.cnt <= JOURNAL_SECTORS - 3
+         && read_record (ofs + desc.cnt + 1, COMMIT_MAGIC, next_seq, b))
+    {
+      for (i = 0; i < desc.cnt; i++)
+        {
+          block_read (fs_device, JOURNAL_SECTOR + ofs + 1 + i, buffer);
+          block_write (fs_device, desc.sectors[i], buffer);
+          replay_cnt++;
+        }
+      ofs += desc.cnt + 2;
+      next_seq++;
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/** Number of sectors in the journal, starting at JOURNAL_SECTOR. */
+#define JOURNAL_SECTORS 64
+
+void journal_init (bool format);
+void journal_begin (size_t credits);
+void journal_end (void);
+bool journal_active (void);
+size_t journal_credits (void);
+void journal_log (block_sector_t);
+void journal_charge (void);
+void journal_commit (void);
+void journal_checkpoint (void);
+void journal_flush (void);
+void journal_print_stats (void);
+
+#endif /**< filesys/journal.h */
@@ -182,3 +182,15 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+memstat (struct memstat *ms)
+{
+  return syscall1 (SYS_MEMSTAT, ms);
+}
+
+void
+fsync (int fd)
+{
+  syscall1 (SYS_FSYNC, fd);
+}
@@ -15,6 +15,20 @@ typedef int mapid_t;
 /** Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/** Memory usage of a process, as reported by memstat().  Its
+   resident set is RESIDENT + SHARED pages. */
+struct memstat
+  {
+    unsigned resident;          /**< Pages in frames of their own. */
+    unsigned shared;            /**< Pages mapping a frame shared with
+                                   other pages, until first written. */
+    unsigned swapped;           /**< Pages in swap. */
+    unsigned file;              /**< Resident pages read from a file. */
+    unsigned minor_faults;      /**< Page faults served without I/O. */
+    unsigned major_faults;      /**< Page faults that read file or swap. */
+    unsigned cow_faults;        /**< First writes to a shared frame. */
+  };
+
 /** Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /**< Successful execution. */
 #define EXIT_FAILURE 1          /**< Unsuccessful execution. */
@@ -45,4 +59,8 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/** Extensions. */
+bool memstat (struct memstat *);
+void fsync (int fd);
+
 #endif /**< lib/user/syscall.h */
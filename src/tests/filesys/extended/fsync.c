@@ -0,0 +1,32 @@
+/** Writes a file, forces it to disk with fsync(), and checks
+   that its contents are intact, both now and after the file
+   system is remounted.  The kernel runs with -nosync, so it
+   powers off without writing anything back itself, and the file
+   survives only if fsync() did its job. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[5678];
+
+void
+test_main (void) 
+{
+  const char *file_name = "fsynced";
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+         "write \"%s\"", file_name);
+  msg ("fsync \"%s\"", file_name);
+  fsync (fd);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
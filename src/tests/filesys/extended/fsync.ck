@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fsync) begin
+(fsync) create "fsynced"
+(fsync) open "fsynced"
+(fsync) write "fsynced"
+(fsync) fsync "fsynced"
+(fsync) close "fsynced"
+(fsync) open "fsynced" for verification
+(fsync) verified contents of "fsynced"
+(fsync) close "fsynced"
+(fsync) end
+EOF
+pass;
@@ -0,0 +1,29 @@
+/** Writes a 3 MB file with a single write(), which takes far more
+   new index and free map sectors than one journal transaction
+   can hold, and checks that its contents are intact, both now
+   and after the file system is remounted. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[3 * 1024 * 1024];
+
+void
+test_main (void) 
+{
+  const char *file_name = "huge";
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+         "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
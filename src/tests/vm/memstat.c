@@ -0,0 +1,47 @@
+/** Reads, then writes, a zero-filled array and checks that
+   memstat() reports its pages as shared until they are written
+   and as resident afterward. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_CNT 64
+#define PAGE_SIZE 4096
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  struct memstat before, after;
+  size_t i;
+  int sum = 0;
+
+  CHECK (memstat (&before), "memstat");
+
+  for (i = 0; i < sizeof buf; i += PAGE_SIZE)
+    sum += buf[i];
+  if (sum != 0)
+    fail ("zero-filled array sums to %d", sum);
+  CHECK (memstat (&after), "memstat after reading");
+
+  /* The first page of BUF may share its page with initialized
+     data, so allow for one page less. */
+  if (after.shared < before.shared + PAGE_CNT - 1)
+    fail ("%u pages shared after reading %d pages, expected %d",
+          after.shared - before.shared, PAGE_CNT, PAGE_CNT - 1);
+
+  for (i = 0; i < sizeof buf; i += PAGE_SIZE)
+    buf[i] = 1;
+  CHECK (memstat (&after), "memstat after writing");
+  if (after.cow_faults < before.cow_faults + PAGE_CNT - 1)
+    fail ("%u copy-on-write faults writing %d pages, expected %d",
+          after.cow_faults - before.cow_faults, PAGE_CNT, PAGE_CNT - 1);
+  if (after.resident + after.swapped
+      < before.resident + before.swapped + PAGE_CNT - 1)
+    fail ("%u more pages resident or swapped after writing %d pages, "
+          "expected %d",
+          (after.resident + after.swapped)
+          - (before.resident + before.swapped), PAGE_CNT, PAGE_CNT - 1);
+}
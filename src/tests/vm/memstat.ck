@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(memstat) begin
+(memstat) memstat
+(memstat) memstat after reading
+(memstat) memstat after writing
+(memstat) end
+EOF
+pass;
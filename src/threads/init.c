@@ -34,9 +34,19 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/ksm.h"
+#include "vm/swap.h"
+#include "vm/zswap.h"
+#endif
 
 /** Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
@@ -52,11 +62,32 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/** -ramdisk: Size of the RAM disk in kB, 0 for none. */
+static size_t ramdisk_kb;
+
+/** -stripe, -stripe-size: Block devices to stripe together, and
+   the stripe size in kB. */
+static char *stripe_members;
+static size_t stripe_kb = 4;
 #endif /**< FILESYS */
 
 /** -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+#ifdef VM
+/** -zswap: Maximum number of pages for the compressed swap cache,
+   0 to disable it. */
+static size_t zswap_pages;
+
+/** -ksm: Pages for same-page merging to examine per scan, 0 to
+   disable it. */
+static size_t ksm_pages;
+
+/** -stack: Maximum size of a user stack, in pages. */
+static size_t stack_pages = 2048;
+#endif
+
 static void bss_init (void);
 static void paging_init (void);
 
@@ -145,10 +176,22 @@ pintos_init (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  virtio_blk_init ();
+  ramdisk_init (ramdisk_kb);
+  stripe_init (stripe_members, stripe_kb);
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
 
+#ifdef VM
+  /* Initialize virtual memory. */
+  page_init (stack_pages);
+  frame_init ();
+  swap_init ();
+  zswap_init (zswap_pages);
+  ksm_init (ksm_pages);
+#endif
+
   printf ("Boot complete.\n");
   
   if (*argv != NULL) {
@@ -284,10 +327,18 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-nosync"))
+        shutdown_nosync = true;
       else if (!strcmp (name, "-filesys"))
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-stripe"))
+        stripe_members = value;
+      else if (!strcmp (name, "-stripe-size"))
+        stripe_kb = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -300,6 +351,16 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-zswap"))
+        zswap_pages = atoi (value);
+      else if (!strcmp (name, "-memstat"))
+        page_exit_stats = true;
+      else if (!strcmp (name, "-ksm"))
+        ksm_pages = atoi (value);
+      else if (!strcmp (name, "-stack"))
+        stack_pages = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -412,16 +473,27 @@ usage (void)
           "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
           "  -f                 Format file system device during startup.\n"
+          "  -nosync            Power off without writing back the file system.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
+          "  -ramdisk=SIZE      Create RAM disk \"ram\" of SIZE kB, e.g. for\n"
+          "                     -filesys=ram -f or -swap=ram.\n"
+          "  -stripe=BDEV,...   Stripe BDEVs together into RAID-0 device \"md0\".\n"
+          "  -stripe-size=SIZE  Use SIZE kB stripes for md0 (default 4).\n"
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -zswap=COUNT       Compress swapped pages into up to COUNT pages.\n"
+          "  -memstat           Print each process's memory usage at exit.\n"
+          "  -ksm=COUNT         Merge identical pages, scanning COUNT per 100 ms.\n"
+          "  -stack=COUNT       Limit user stacks to COUNT pages (default 2048).\n"
 #endif
           );
   shutdown_power_off ();
@@ -663,6 +663,10 @@ init_thread (struct thread *t, const char *name, int priority)
   t->magic = THREAD_MAGIC;
   list_init(&t->lock_list);
   list_init(&t->child_list); // as_child initialization will be done later, see thread_create()
+#ifdef VM
+  list_init (&t->mappings);
+  t->next_mapid = 0;
+#endif
   sema_init(&t->sema_exec, 0);
 
   old_level = intr_disable ();
@@ -815,9 +819,7 @@ void thread_close_file(int fd) {
   if (t->fd_table[fd] == NULL) {
     return;
   }
-  lock_acquire(&filesys_lock);
   file_close(t->fd_table[fd]);
-  lock_release(&filesys_lock);
   t->fd_table[fd] = NULL;
 }
 
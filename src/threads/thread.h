@@ -6,6 +6,9 @@
 #include <debug.h>
 #include <list.h>
 #include <stdint.h>
+#ifdef VM
+#include <hash.h>
+#endif
 
 /** States in a thread's life cycle. */
 enum thread_status
@@ -123,6 +126,24 @@ struct thread
     uint32_t *pagedir;                  /**< Page directory. */
 #endif
 
+#ifdef VM
+    /* Owned by vm/page.c and vm/mmap.c. */
+    struct hash pages;                  /**< Supplemental page table. */
+    struct list mappings;               /**< File mappings. */
+    int next_mapid;                     /**< Next mmap() map id. */
+    void *user_esp;                     /**< User stack pointer on entry
+                                           to the current system call. */
+    unsigned minor_faults;              /**< Faults served without I/O. */
+    unsigned major_faults;              /**< Faults that read file or swap. */
+    unsigned cow_faults;                /**< First writes to shared frames. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /**< Nesting of journal operations. */
+    size_t journal_credits;             /**< Sectors its operation may add. */
+#endif
+
     /* Owned by thread.c. */
     unsigned magic;                     /**< Detects stack overflow. */
   };
@@ -4,6 +4,9 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef VM
+#include "vm/page.h"
+#endif
 
 /** Number of page faults processed. */
 static long long page_fault_cnt;
@@ -158,6 +161,18 @@ page_fault (struct intr_frame *f)
   //         write ? "writing" : "reading",
   //         user ? "user" : "kernel");
 
+#ifdef VM
+  /* A not-present page that belongs to the process is brought in
+     and the faulting instruction restarted.  So is a write to a
+     page that still maps the shared zero page read-only.  This
+     also covers the kernel touching user memory on a process's
+     behalf. */
+  if ((not_present || write)
+      && page_fault_in (fault_addr, write,
+                        user ? f->esp : thread_current ()->user_esp))
+    return;
+#endif
+
   // The only chance that a page fault happens in kernel context is when dealing 
   // with user-provided pointer through system call, because kernel code shouldn't 
   // produce page faults (if we're writing it right...)
@@ -20,6 +20,10 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
@@ -88,13 +92,11 @@ start_process (void *proc_cmd_)
   proc_name = strtok_r(proc_cmd, " ", &save_ptr);
 
   /* Deny writes to executable file.*/
-  lock_acquire(&filesys_lock);
   struct file *f = filesys_open(proc_name);
   if (f != NULL) {
     file_deny_write(f);
     thread_current()->exec_file = f;
   }
-  lock_release(&filesys_lock);
 
   /* Initialize interrupt frame and load executable. */
   memset (&if_, 0, sizeof if_);
@@ -231,6 +233,16 @@ process_exit (void)
   pd = cur->pagedir;
   if (pd != NULL) 
     {
+#ifdef VM
+      if (page_exit_stats)
+        page_print_usage ();
+
+      /* Release the process's pages, writing back dirty mmap'd
+         pages, while the page directory still maps them. */
+      page_table_destroy ();
+      mapping_destroy_all ();
+#endif
+
       /* Correct ordering here is crucial.  We must set
          cur->pagedir to NULL before switching page directories,
          so that a timer interrupt can't switch back to the
@@ -244,9 +256,7 @@ process_exit (void)
     }
 
   // Close the executable file and re-enable writes.
-  lock_acquire(&filesys_lock);
   file_close(cur->exec_file);
-  lock_release(&filesys_lock);
 
 }
 
@@ -353,6 +363,14 @@ load (const char *file_name, void (**eip) (void), void **esp)
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
     goto done;
+#ifdef VM
+  if (!page_table_init ())
+    {
+      pagedir_destroy (t->pagedir);
+      t->pagedir = NULL;
+      goto done;
+    }
+#endif
   process_activate ();
 
   /* Open executable file. */
@@ -452,7 +470,9 @@ load (const char *file_name, void (**eip) (void), void **esp)
 
 /** load() helpers. */
 
+#ifndef VM
 static bool install_page (void *upage, void *kpage, bool writable);
+#endif
 
 /** Checks whether PHDR describes a valid, loadable segment in
    FILE and returns true if so, false otherwise. */
@@ -512,7 +532,54 @@ validate_segment (const struct Elf32_Phdr *phdr, struct file *file)
    user process if WRITABLE is true, read-only otherwise.
 
    Return true if successful, false if a memory allocation error
-   or disk read error occurs. */
+   or disk read error occurs.
+
+   With virtual memory, nothing is read here: each page is only
+   recorded in the supplemental page table and is brought in by
+   the page fault handler when first touched. */
+#ifdef VM
+static bool
+load_segment (struct file *file, off_t ofs, uint8_t *upage,
+              uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
+{
+  struct mapping *m = NULL;
+
+  ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
+  ASSERT (pg_ofs (upage) == 0);
+  ASSERT (ofs % PGSIZE == 0);
+
+  /* The segment's pages keep their own handle on the executable,
+     since load() closes FILE when it is done. */
+  if (read_bytes > 0)
+    {
+      m = mapping_create (file_reopen (file), upage,
+                          DIV_ROUND_UP (read_bytes, PGSIZE));
+      if (m == NULL || m->file == NULL)
+        return false;
+    }
+
+  while (read_bytes > 0 || zero_bytes > 0) 
+    {
+      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+      size_t page_zero_bytes = PGSIZE - page_read_bytes;
+      struct page *p;
+
+      if (page_read_bytes > 0)
+        p = page_create_file (upage, m, ofs, page_read_bytes, writable);
+      else
+        p = page_create_zero (upage, writable);
+      if (p == NULL)
+        return false;
+
+      /* Advance. */
+      read_bytes -= page_read_bytes;
+      zero_bytes -= page_zero_bytes;
+      ofs += PGSIZE;
+      upage += PGSIZE;
+    }
+  return true;
+}
+#else
 static bool
 load_segment (struct file *file, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
@@ -557,12 +624,20 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
     }
   return true;
 }
+#endif
 
 /** Create a minimal stack by mapping a zeroed page at the top of
    user virtual memory. */
 static bool
 setup_stack (void **esp) 
 {
+#ifdef VM
+  struct page *p = page_create_zero (((uint8_t *) PHYS_BASE) - PGSIZE, true);
+  if (p == NULL || !page_load (p))
+    return false;
+  *esp = PHYS_BASE;
+  return true;
+#else
   uint8_t *kpage;
   bool success = false;
 
@@ -576,6 +651,7 @@ setup_stack (void **esp)
         palloc_free_page (kpage);
     }
   return success;
+#endif
 }
 
 /** Adds a mapping from user virtual address UPAGE to kernel
@@ -587,6 +663,7 @@ setup_stack (void **esp)
    with palloc_get_page().
    Returns true on success, false if UPAGE is already mapped or
    if memory allocation fails. */
+#ifndef VM
 static bool
 install_page (void *upage, void *kpage, bool writable)
 {
@@ -597,3 +674,4 @@ install_page (void *upage, void *kpage, bool writable)
   return (pagedir_get_page (t->pagedir, upage) == NULL
           && pagedir_set_page (t->pagedir, upage, kpage, writable));
 }
+#endif
@@ -8,7 +8,12 @@
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "user/syscall.h"
+#include "filesys/file.h"
 #include "filesys/filesys.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static void syscall_handler (struct intr_frame *);
 static int get_user (const uint8_t *uaddr);
@@ -32,6 +37,12 @@ static void syscall_read(struct intr_frame *f);
 static void syscall_write(struct intr_frame *f);
 static void syscall_seek(struct intr_frame *f);
 static void syscall_tell(struct intr_frame *f);
+static void syscall_fsync(struct intr_frame *f);
+#ifdef VM
+static void syscall_mmap(struct intr_frame *f);
+static void syscall_munmap(struct intr_frame *f);
+static void syscall_memstat(struct intr_frame *f);
+#endif
 
 void syscall_init (void) {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
@@ -69,7 +80,16 @@ syscall_write(struct intr_frame *f) {
     if (file_ptr == NULL) {
       f->eax = -1;
     } else {
+#ifdef VM
+      /* The disk driver copies straight out of BUF, so it must stay
+         resident for the duration. */
+      if (!page_pin_range(buf, size, false))
+        terminate_process();
       f->eax = file_write(file_ptr, buf, size);
+      page_unpin_range(buf, size);
+#else
+      f->eax = file_write(file_ptr, buf, size);
+#endif
     }
   }
 }
@@ -106,9 +126,7 @@ static void syscall_create(struct intr_frame *f) {
     terminate_process();
   }
 
-  lock_acquire(&filesys_lock);
   f->eax = filesys_create(file, initial_size);
-  lock_release(&filesys_lock);
 
 }
 
@@ -119,9 +137,7 @@ static void syscall_remove(struct intr_frame *f) {
   char* file = *(char**)(f->esp + ptr_size);
   check_read_user_str(file);
 
-  lock_acquire(&filesys_lock);
   f->eax = filesys_remove(file);
-  lock_release(&filesys_lock);
 }
 
 static void syscall_open(struct intr_frame *f) {
@@ -135,9 +151,7 @@ static void syscall_open(struct intr_frame *f) {
     terminate_process();
   }
 
-  lock_acquire(&filesys_lock);
   struct file* open_file = filesys_open(file);
-  lock_release(&filesys_lock);
 
   if (open_file == NULL) {
     f->eax = -1;
@@ -190,7 +204,16 @@ static void syscall_read(struct intr_frame *f) {
     if (file_ptr == NULL) {
       f->eax = -1;
     } else {
+#ifdef VM
+      /* The disk driver copies straight into BUFFER, so it must be
+         resident and writable for the duration. */
+      if (!page_pin_range(buffer, size, true))
+        terminate_process();
+      f->eax = file_read(file_ptr, buffer, size);
+      page_unpin_range(buffer, size);
+#else
       f->eax = file_read(file_ptr, buffer, size);
+#endif
     }
   }
 }
@@ -222,10 +245,72 @@ static void syscall_tell(struct intr_frame *f) {
   f->eax = file_tell(file_ptr);
 }
 
+static void syscall_fsync(struct intr_frame *f) {
+  int ptr_size = sizeof(void *);
+  check_read_user_buffer(f->esp + ptr_size, ptr_size);
+
+  int fd = *(int *)(f->esp + ptr_size);
+  struct file* file_ptr = thread_get_file(fd);
+  if (file_ptr == NULL) {
+    terminate_process();
+  }
+  file_sync(file_ptr);
+}
+
+#ifdef VM
+static void syscall_mmap(struct intr_frame *f) {
+  int ptr_size = sizeof(void *);
+  check_read_user_buffer(f->esp + ptr_size, 2 * ptr_size);
+
+  int fd = *(int *)(f->esp + ptr_size);
+  void *addr = *(void **)(f->esp + 2 * ptr_size);
+
+  struct file* file_ptr = thread_get_file(fd);
+  if (file_ptr == NULL) {
+    f->eax = -1;
+  } else {
+    f->eax = mmap_map(file_ptr, addr);
+  }
+}
+
+static void syscall_munmap(struct intr_frame *f) {
+  int ptr_size = sizeof(void *);
+  check_read_user_buffer(f->esp + ptr_size, ptr_size);
+
+  int mapid = *(int *)(f->esp + ptr_size);
+  mmap_unmap(mapid);
+}
+
+static void syscall_memstat(struct intr_frame *f) {
+  int ptr_size = sizeof(void *);
+  check_read_user_buffer(f->esp + ptr_size, ptr_size);
+
+  struct memstat *ms = *(struct memstat **)(f->esp + ptr_size);
+  check_write_user_buffer(ms, sizeof *ms);
+
+  struct thread *cur = thread_current();
+  struct page_usage u;
+  page_get_usage(cur, &u);
+  ms->resident = u.resident;
+  ms->shared = u.shared;
+  ms->swapped = u.swapped;
+  ms->file = u.file;
+  ms->minor_faults = cur->minor_faults;
+  ms->major_faults = cur->major_faults;
+  ms->cow_faults = cur->cow_faults;
+  f->eax = true;
+}
+#endif
+
 static void
 syscall_handler (struct intr_frame *f UNUSED) 
 {
   // printf ("system call!\n");
+#ifdef VM
+  /* Page faults taken on the process's behalf need this to tell
+     stack growth from a bad pointer. */
+  thread_current()->user_esp = f->esp;
+#endif
   check_read_user_buffer(f->esp, sizeof(void*));
 
   int syscall_type = *(int*)f->esp;
@@ -269,6 +354,20 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_TELL:
       syscall_tell(f);
       break;
+    case SYS_FSYNC:
+      syscall_fsync(f);
+      break;
+#ifdef VM
+    case SYS_MMAP:
+      syscall_mmap(f);
+      break;
+    case SYS_MUNMAP:
+      syscall_munmap(f);
+      break;
+    case SYS_MEMSTAT:
+      syscall_memstat(f);
+      break;
+#endif
     default:
       NOT_REACHED();
   }
@@ -276,13 +375,24 @@ syscall_handler (struct intr_frame *f UNUSED)
 }
 
 static void *check_read_user_buffer(const void* buffer, size_t size) {
-  size_t i;
+  const uint8_t *end = (const uint8_t *) buffer + size;
+  const uint8_t *p;
+
   if (!is_user_vaddr(buffer)) {
     terminate_process();
   }
+  if (size == 0) {
+    return (void *)buffer;
+  }
+  if (end < (const uint8_t *) buffer || !is_user_vaddr(end - 1)) {
+    terminate_process();
+  }
 
-  for (i = 0; i < size; i++) {
-    if (get_user(buffer + i) == -1) {
+  /* Mappings are per page, so touching one byte of each page is
+     enough.  Under VM this also faults in (or grows the stack to
+     cover) any page that is not yet present. */
+  for (p = buffer; p < end; p = (const uint8_t *) pg_round_down(p) + PGSIZE) {
+    if (get_user(p) == -1) {
       terminate_process();
     }
   }
@@ -290,19 +400,26 @@ static void *check_read_user_buffer(const void* buffer, size_t size) {
 }
 
 
+/* Checks that BUFFER is writable, clobbering the first byte of
+   each page it covers. */
 static void *check_write_user_buffer(void* buffer, size_t size) {
-  size_t i = 0;
-  void *ptr = buffer;
+  uint8_t *end = (uint8_t *) buffer + size;
+  uint8_t *p;
   
   if (!is_user_vaddr(buffer)) {
     terminate_process();
   }
+  if (size == 0) {
+    return buffer;
+  }
+  if (end < (uint8_t *) buffer || !is_user_vaddr(end - 1)) {
+    terminate_process();
+  }
 
-  for (i = 0; i < size; i++) {
-    if (!put_user(ptr + i, 0)) {
+  for (p = buffer; p < end; p = (uint8_t *) pg_round_down(p) + PGSIZE) {
+    if (!put_user(p, 0)) {
       terminate_process();
     }
-    ptr++;
   }
   return buffer;
 }
@@ -0,0 +1,426 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "vm/page.h"
+
+/** Frame table.  Every user-pool frame that backs a user page is
+   on FRAME_LIST, which the clock hand sweeps when a frame must be
+   reclaimed. */
+static struct list frame_list;
+static struct list_elem *clock_hand;
+static struct list_elem *scan_hand; /**< Same-page merging cursor. */
+static size_t frame_cnt;            /**< Number of frames in FRAME_LIST. */
+static struct lock frame_lock;
+
+/** Pageout daemon.  When fewer than FREE_LOW user frames are free,
+   the daemon is woken.  It first writes out dirty pages among the
+   next CLEAN_AHEAD frames the clock hand will reach, leaving them
+   mapped, so that they can later be reclaimed without a write,
+   then evicts pages until FREE_HIGH frames are free.  Page faults
+   then usually find a free frame, or at worst a clean victim,
+   instead of waiting for a write themselves.
+
+   If the daemon finds nothing to evict, it is not woken again
+   until a frame is freed, since until then it would only sweep
+   the clock for nothing. */
+static size_t user_frame_cnt;       /**< Size of the user pool. */
+static size_t free_low, free_high;  /**< Free frame watermarks. */
+static size_t clean_ahead;          /**< Frames to clean per wakeup. */
+static struct semaphore pageout_sema;
+static bool pageout_stalled;        /**< Found nothing to evict? */
+
+/** Statistics. */
+static long long pageout_cnt;       /**< # of frames freed by the daemon. */
+static long long clean_cnt;         /**< # of pages cleaned by the daemon. */
+static long long direct_cnt;        /**< # of evictions by faulting threads. */
+static int64_t stall_ticks;         /**< Ticks spent in those evictions. */
+
+static struct frame *frame_evict (void);
+static void frame_unlink (struct frame *);
+static bool frame_lock_page (struct frame *);
+static void pageout_wake (void);
+static thread_func pageout_daemon NO_RETURN;
+
+/** Initializes the frame table and starts the pageout daemon. */
+void
+frame_init (void)
+{
+  list_init (&frame_list);
+  lock_init (&frame_lock);
+  clock_hand = list_end (&frame_list);
+  scan_hand = list_head (&frame_list);
+
+  user_frame_cnt = palloc_user_page_cnt ();
+  free_low = DIV_ROUND_UP (user_frame_cnt, 64);
+  free_high = 2 * free_low;
+  clean_ahead = 2 * free_high;
+  sema_init (&pageout_sema, 0);
+  thread_create ("pageout", PRI_DEFAULT, pageout_daemon, NULL);
+}
+
+/** Obtains a frame for PAGE.  Takes a free user-pool page if one
+   is available.  Otherwise, if MAY_EVICT is true, evicts another
+   page to make room; if it is false, returns a null pointer
+   instead.  Also returns a null pointer if every frame is pinned.
+
+   The frame is returned pinned.  The caller unpins it once PAGE
+   is installed. */
+struct frame *
+frame_alloc (struct page *page, bool may_evict)
+{
+  void *kpage = palloc_get_page (PAL_USER);
+  struct frame *f;
+  bool low;
+
+  if (kpage == NULL)
+    {
+      int64_t start;
+
+      if (!may_evict)
+        return NULL;
+      pageout_wake ();
+      start = timer_ticks ();
+      f = frame_evict ();
+      stall_ticks += timer_elapsed (start);
+      direct_cnt++;
+      if (f != NULL)
+        f->page = page;
+      return f;
+    }
+
+  f = malloc (sizeof *f);
+  if (f == NULL)
+    {
+      palloc_free_page (kpage);
+      return NULL;
+    }
+  f->kpage = kpage;
+  f->page = page;
+  f->pinned = true;
+
+  lock_acquire (&frame_lock);
+  list_push_back (&frame_list, &f->elem);
+  frame_cnt++;
+  low = user_frame_cnt - frame_cnt < free_low;
+  lock_release (&frame_lock);
+  if (low)
+    pageout_wake ();
+  return f;
+}
+
+/** Removes F from the frame table and returns its page to the
+   user pool. */
+void
+frame_free (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  frame_unlink (f);
+  frame_cnt--;
+  pageout_stalled = false;
+  lock_release (&frame_lock);
+
+  palloc_free_page (f->kpage);
+  free (f);
+}
+
+/** Prevents F from being evicted. */
+void
+frame_pin (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  f->pinned = true;
+  lock_release (&frame_lock);
+}
+
+/** Allows F to be evicted again. */
+void
+frame_unpin (struct frame *f)
+{
+  lock_acquire (&frame_lock);
+  f->pinned = false;
+  lock_release (&frame_lock);
+}
+
+/** Returns the next frame after the same-page merging cursor whose
+   page can be locked without waiting, with the page locked and the
+   frame pinned.  Sets *WRAPPED to true if the cursor passes the
+   end of the frame table.  Returns a null pointer if no frame is
+   available in a full sweep. */
+struct frame *
+frame_scan_next (bool *wrapped)
+{
+  size_t tries;
+
+  lock_acquire (&frame_lock);
+  for (tries = list_size (&frame_list) + 1; tries-- > 0; )
+    {
+      struct frame *f;
+
+      scan_hand = list_next (scan_hand);
+      if (scan_hand == list_end (&frame_list))
+        {
+          *wrapped = true;
+          scan_hand = list_head (&frame_list);
+          continue;
+        }
+
+      f = list_entry (scan_hand, struct frame, elem);
+      if (frame_lock_page (f))
+        {
+          lock_release (&frame_lock);
+          return f;
+        }
+    }
+  lock_release (&frame_lock);
+  return NULL;
+}
+
+/** Returns the frame at KPAGE with its page locked and the frame
+   pinned, as frame_scan_next() does, or a null pointer if KPAGE is
+   not in the frame table or its page is busy. */
+struct frame *
+frame_lock_kpage (const void *kpage)
+{
+  struct list_elem *e;
+
+  lock_acquire (&frame_lock);
+  for (e = list_begin (&frame_list); e != list_end (&frame_list);
+       e = list_next (e))
+    {
+      struct frame *f = list_entry (e, struct frame, elem);
+      if (f->kpage == kpage)
+        {
+          bool locked = frame_lock_page (f);
+          lock_release (&frame_lock);
+          return locked ? f : NULL;
+        }
+    }
+  lock_release (&frame_lock);
+  return NULL;
+}
+
+/** Removes F, which must be pinned, from the frame table and frees
+   it, but keeps its user-pool page, which is returned.  The page
+   is never evicted, and must eventually be passed to
+   frame_free_detached(). */
+void *
+frame_detach (struct frame *f)
+{
+  void *kpage = f->kpage;
+
+  ASSERT (f->pinned);
+
+  lock_acquire (&frame_lock);
+  frame_unlink (f);
+  lock_release (&frame_lock);
+
+  free (f);
+  return kpage;
+}
+
+/** Returns KPAGE, obtained from frame_detach(), to the user pool. */
+void
+frame_free_detached (void *kpage)
+{
+  lock_acquire (&frame_lock);
+  frame_cnt--;
+  pageout_stalled = false;
+  lock_release (&frame_lock);
+
+  palloc_free_page (kpage);
+}
+
+/** Prints frame reclamation statistics. */
+void
+frame_print_stats (void)
+{
+  printf ("Frames: %lld freed and %lld cleaned by pageout daemon, "
+          "%lld direct evictions stalling %lld ticks\n",
+          pageout_cnt, clean_cnt, direct_cnt, stall_ticks);
+}
+
+/** Wakes the pageout daemon, unless it is stalled. */
+static void
+pageout_wake (void)
+{
+  if (!pageout_stalled)
+    sema_up (&pageout_sema);
+}
+
+/** Returns the element after E in FRAME_LIST, wrapping around.
+   E may be the list end, and FRAME_LIST must not be empty. */
+static struct list_elem *
+ring_next (struct list_elem *e)
+{
+  if (e != list_end (&frame_list))
+    e = list_next (e);
+  if (e == list_end (&frame_list))
+    e = list_begin (&frame_list);
+  return e;
+}
+
+/** Writes out dirty pages in the CLEAN_AHEAD frames past the clock
+   hand, which are the next candidates for eviction. */
+static void
+frame_clean_ahead (void)
+{
+  struct list_elem *e;
+  size_t cnt, i;
+
+  lock_acquire (&frame_lock);
+  e = clock_hand;
+  cnt = list_size (&frame_list);
+  if (cnt > clean_ahead)
+    cnt = clean_ahead;
+  for (i = 0; i < cnt; i++)
+    {
+      struct frame *f;
+      struct page *p;
+
+      e = ring_next (e);
+      f = list_entry (e, struct frame, elem);
+      if (!frame_lock_page (f))
+        continue;
+      p = f->page;
+      lock_release (&frame_lock);
+
+      if (page_clean (p))
+        clean_cnt++;
+
+      /* Retake FRAME_LOCK before unlocking P, so that F, and with
+         it E, stays in the frame table. */
+      lock_acquire (&frame_lock);
+      f->pinned = false;
+      lock_release (&p->lock);
+    }
+  lock_release (&frame_lock);
+}
+
+/** Pageout daemon thread.  Each time it is woken, cleans the
+   frames ahead of the clock hand, then frees frames until
+   FREE_HIGH are free or nothing more can be evicted. */
+static void
+pageout_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      sema_down (&pageout_sema);
+      frame_clean_ahead ();
+      for (;;)
+        {
+          struct frame *f;
+
+          lock_acquire (&frame_lock);
+          if (user_frame_cnt - frame_cnt >= free_high)
+            {
+              lock_release (&frame_lock);
+              break;
+            }
+          lock_release (&frame_lock);
+
+          f = frame_evict ();
+          if (f == NULL)
+            {
+              lock_acquire (&frame_lock);
+              pageout_stalled = true;
+              lock_release (&frame_lock);
+              break;
+            }
+          frame_free (f);
+          pageout_cnt++;
+        }
+    }
+}
+
+/** Removes F from FRAME_LIST, moving the cursors off it. */
+static void
+frame_unlink (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (clock_hand == &f->elem)
+    clock_hand = list_next (clock_hand);
+  if (scan_hand == &f->elem)
+    scan_hand = list_prev (scan_hand);
+  list_remove (&f->elem);
+}
+
+/** Tries to lock F's page and pin F, for use by the same-page
+   merging scan.  Fails if F is pinned, empty, or its page is
+   busy. */
+static bool
+frame_lock_page (struct frame *f)
+{
+  ASSERT (lock_held_by_current_thread (&frame_lock));
+
+  if (f->pinned || f->page == NULL || !lock_try_acquire (&f->page->lock))
+    return false;
+  if (f->pinned)
+    {
+      lock_release (&f->page->lock);
+      return false;
+    }
+  f->pinned = true;
+  return true;
+}
+
+/** Advances the clock hand, wrapping around, and returns the
+   frame it lands on.  FRAME_LIST must not be empty. */
+static struct frame *
+clock_next (void)
+{
+  clock_hand = ring_next (clock_hand);
+  return list_entry (clock_hand, struct frame, elem);
+}
+
+/** Chooses a victim with the clock algorithm, writes its page
+   out, and returns the now-empty frame, pinned.  Returns a null
+   pointer if no frame could be reclaimed in two sweeps.
+
+   A page whose lock is held is being faulted in, evicted, or torn
+   down by someone else, so it is skipped rather than waited for. */
+static struct frame *
+frame_evict (void)
+{
+  size_t tries;
+
+  lock_acquire (&frame_lock);
+  tries = 2 * list_size (&frame_list);
+  while (tries-- > 0)
+    {
+      struct frame *f = clock_next ();
+      struct page *p = f->page;
+
+      if (f->pinned || p == NULL || !lock_try_acquire (&p->lock))
+        continue;
+      if (f->pinned || page_accessed_recently (p))
+        {
+          lock_release (&p->lock);
+          continue;
+        }
+
+      /* Keep the frame to ourselves while the page is written
+         out, so that other faults may proceed meanwhile. */
+      f->pinned = true;
+      lock_release (&frame_lock);
+
+      if (!page_evict (p))
+        {
+          lock_release (&p->lock);
+          lock_acquire (&frame_lock);
+          f->pinned = false;
+          continue;
+        }
+      lock_release (&p->lock);
+      f->page = NULL;
+      return f;
+    }
+  lock_release (&frame_lock);
+  return NULL;
+}
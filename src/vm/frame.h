@@ -0,0 +1,30 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <list.h>
+#include <stdbool.h>
+
+struct page;
+
+/** A physical frame from the user pool. */
+struct frame
+  {
+    void *kpage;                /**< Kernel virtual address of the frame. */
+    struct page *page;          /**< Page occupying the frame. */
+    bool pinned;                /**< True if the frame must not be evicted. */
+    struct list_elem elem;      /**< Element in the frame table. */
+  };
+
+void frame_init (void);
+struct frame *frame_alloc (struct page *, bool may_evict);
+void frame_free (struct frame *);
+void frame_pin (struct frame *);
+void frame_unpin (struct frame *);
+void frame_print_stats (void);
+
+struct frame *frame_scan_next (bool *wrapped);
+struct frame *frame_lock_kpage (const void *kpage);
+void *frame_detach (struct frame *);
+void frame_free_detached (void *kpage);
+
+#endif /**< vm/frame.h */
@@ -0,0 +1,350 @@
+#include "vm/ksm.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/mmap.h"
+#include "vm/page.h"
+#include "vm/swap.h"
+
+/** Same-page merging.
+
+   A low-priority thread walks the frame table, SCAN_PAGES frames
+   every SCAN_PERIOD ticks, and hashes each page it visits.  A page
+   whose contents match a merged frame is remapped read-only onto
+   it and its own frame freed.  Otherwise the page is remembered as
+   a candidate, by checksum, until the walk wraps around; a later
+   page with the same checksum and the same contents is merged with
+   it into a new merged frame.
+
+   Merged frames leave the frame table, so they are never evicted.
+   The first write to a merged page faults and page_in() gives the
+   page a private copy.
+
+   Pages of mmap'd files are not merged, since their writes must
+   reach the file.  A page is unmapped while it is examined, so its
+   owner cannot modify it meanwhile. */
+
+#define SCAN_PERIOD (TIMER_FREQ / 10)
+
+/** A page seen earlier in the current walk. */
+struct candidate
+  {
+    unsigned checksum;          /**< Hash of the page's contents. */
+    void *kpage;                /**< Frame it was in when seen. */
+    struct hash_elem elem;      /**< Element in candidates. */
+  };
+
+static size_t scan_pages;       /**< Frames per scan, 0 if disabled. */
+static struct hash merged;      /**< Merged frames, protected by ksm_lock. */
+static struct lock ksm_lock;
+static struct hash candidates;  /**< Used by the scan thread only. */
+
+/** Statistics. */
+static long long scan_cnt;      /**< # of pages examined. */
+static size_t sharing_cnt;      /**< # of pages mapping a merged frame. */
+
+static thread_func ksm_daemon NO_RETURN;
+static void ksm_scan (struct frame *);
+static hash_hash_func merged_hash, candidate_hash;
+static hash_less_func merged_less, candidate_less;
+static hash_action_func candidate_free;
+
+/** Starts merging identical user pages, examining SCAN_PAGES
+   frames every SCAN_PERIOD ticks.  A SCAN_PAGES of 0 disables
+   merging. */
+void
+ksm_init (size_t scan_pages_)
+{
+  lock_init (&ksm_lock);
+  if (scan_pages_ == 0)
+    return;
+
+  if (!hash_init (&merged, merged_hash, merged_less, NULL)
+      || !hash_init (&candidates, candidate_hash, candidate_less, NULL))
+    PANIC ("ksm: hash table creation failed");
+  scan_pages = scan_pages_;
+  thread_create ("ksm", PRI_MIN, ksm_daemon, NULL);
+}
+
+/** Drops a reference to merged frame K, freeing it when no page
+   maps it any longer. */
+void
+ksm_put (struct ksm_frame *k)
+{
+  void *kpage = NULL;
+
+  lock_acquire (&ksm_lock);
+  sharing_cnt--;
+  if (--k->ref_cnt == 0)
+    {
+      hash_delete (&merged, &k->elem);
+      kpage = k->kpage;
+      free (k);
+    }
+  lock_release (&ksm_lock);
+
+  if (kpage != NULL)
+    frame_free_detached (kpage);
+}
+
+/** Prints same-page merging statistics. */
+void
+ksm_print_stats (void)
+{
+  size_t merged_cnt;
+
+  if (scan_pages == 0)
+    return;
+
+  merged_cnt = hash_size (&merged);
+  printf ("KSM: %lld pages scanned, %zu merged frames shared by %zu pages, "
+          "%zu frames saved\n",
+          scan_cnt, merged_cnt, sharing_cnt, sharing_cnt - merged_cnt);
+}
+
+/** Scan thread. */
+static void
+ksm_daemon (void *aux UNUSED)
+{
+  for (;;)
+    {
+      size_t i;
+
+      for (i = 0; i < scan_pages; i++)
+        {
+          bool wrapped = false;
+          struct frame *f = frame_scan_next (&wrapped);
+
+          if (wrapped)
+            hash_clear (&candidates, candidate_free);
+          if (f == NULL)
+            break;
+          ksm_scan (f);
+          scan_cnt++;
+        }
+      timer_sleep (SCAN_PERIOD);
+    }
+}
+
+/** Returns true if P, locked and resident, may be merged. */
+static bool
+mergeable (const struct page *p)
+{
+  return !(p->type == PAGE_FILE && p->mapping->id >= 0);
+}
+
+/** Unmaps P, which must be locked and resident, and returns whether
+   it was dirty. */
+static bool
+unmap (struct page *p)
+{
+  pagedir_clear_page (p->owner->pagedir, p->upage);
+  return pagedir_is_dirty (p->owner->pagedir, p->upage);
+}
+
+/** Maps P back onto its own frame, after unmap(). */
+static void
+remap (struct page *p, bool dirty)
+{
+  pagedir_set_page (p->owner->pagedir, p->upage, p->frame->kpage,
+                    p->writable);
+  pagedir_set_dirty (p->owner->pagedir, p->upage, dirty);
+}
+
+/** Maps unmapped page P onto merged frame K, on which the caller
+   holds a reference for P, and frees P's own frame unless that
+   frame has become K.  A page that was DIRTY no longer matches its
+   file or zero backing, so from now on it goes to swap.  Any copy
+   page_clean() left in swap is dropped, since the page is written
+   out afresh if it is ever evicted. */
+static void
+share (struct page *p, bool dirty, struct ksm_frame *k)
+{
+  struct frame *f = p->frame;
+
+  if (dirty)
+    p->type = PAGE_SWAP;
+  if (p->swap_slot != SWAP_NONE)
+    {
+      swap_free (p->swap_slot);
+      p->swap_slot = SWAP_NONE;
+    }
+  p->frame = NULL;
+  p->ksm = k;
+  p->read_ahead = false;
+
+  /* Cannot fail: P's page table already exists. */
+  pagedir_set_page (p->owner->pagedir, p->upage, k->kpage, false);
+  if (f->kpage != k->kpage)
+    frame_free (f);
+}
+
+/** Unpins P's frame, if it still has one, and unlocks P. */
+static void
+release (struct page *p)
+{
+  if (p->frame != NULL)
+    frame_unpin (p->frame);
+  lock_release (&p->lock);
+}
+
+/** Returns the merged frame whose contents equal the page at KPAGE,
+   with a new reference taken, or a null pointer. */
+static struct ksm_frame *
+merged_get (void *kpage, unsigned checksum)
+{
+  struct ksm_frame key, *k = NULL;
+  struct hash_elem *e;
+
+  key.kpage = kpage;
+  key.checksum = checksum;
+  lock_acquire (&ksm_lock);
+  e = hash_find (&merged, &key.elem);
+  if (e != NULL)
+    {
+      k = hash_entry (e, struct ksm_frame, elem);
+      k->ref_cnt++;
+      sharing_cnt++;
+    }
+  lock_release (&ksm_lock);
+  return k;
+}
+
+/** Looks for a candidate page identical to the one in frame F.  If
+   there is one, turns its frame into a new merged frame and returns
+   it, with a reference taken for F's page.  Otherwise records F as
+   the candidate for CHECKSUM and returns a null pointer. */
+static struct ksm_frame *
+merge_candidate (struct frame *f, unsigned checksum)
+{
+  struct candidate key, *c;
+  struct hash_elem *e;
+  struct ksm_frame *k = NULL;
+  struct frame *g;
+
+  key.checksum = checksum;
+  e = hash_find (&candidates, &key.elem);
+  if (e == NULL)
+    {
+      c = malloc (sizeof *c);
+      if (c != NULL)
+        {
+          c->checksum = checksum;
+          c->kpage = f->kpage;
+          hash_insert (&candidates, &c->elem);
+        }
+      return NULL;
+    }
+
+  c = hash_entry (e, struct candidate, elem);
+  if (c->kpage != f->kpage && (g = frame_lock_kpage (c->kpage)) != NULL)
+    {
+      struct page *q = g->page;
+
+      if (mergeable (q))
+        {
+          bool dirty = unmap (q);
+
+          if (!memcmp (f->kpage, g->kpage, PGSIZE)
+              && (k = malloc (sizeof *k)) != NULL)
+            {
+              k->kpage = g->kpage;
+              k->checksum = checksum;
+              k->ref_cnt = 2;
+              share (q, dirty, k);
+              frame_detach (g);
+
+              lock_acquire (&ksm_lock);
+              hash_insert (&merged, &k->elem);
+              sharing_cnt += 2;
+              lock_release (&ksm_lock);
+            }
+          else
+            remap (q, dirty);
+        }
+      release (q);
+    }
+
+  if (k != NULL)
+    {
+      hash_delete (&candidates, &c->elem);
+      free (c);
+    }
+  else
+    c->kpage = f->kpage;
+  return k;
+}
+
+/** Examines frame F, whose page is locked and which is pinned, and
+   merges its page if an identical one is known. */
+static void
+ksm_scan (struct frame *f)
+{
+  struct page *p = f->page;
+  struct ksm_frame *k;
+  unsigned checksum;
+  bool dirty;
+
+  if (mergeable (p))
+    {
+      dirty = unmap (p);
+      checksum = hash_bytes (f->kpage, PGSIZE);
+      k = merged_get (f->kpage, checksum);
+      if (k == NULL)
+        k = merge_candidate (f, checksum);
+
+      if (k != NULL)
+        share (p, dirty, k);
+      else
+        remap (p, dirty);
+    }
+  release (p);
+}
+
+static unsigned
+merged_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_entry (e, struct ksm_frame, elem)->checksum;
+}
+
+/** Orders merged frames by checksum, then by contents, so that
+   hash_find() only matches identical pages. */
+static bool
+merged_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct ksm_frame *a = hash_entry (a_, struct ksm_frame, elem);
+  const struct ksm_frame *b = hash_entry (b_, struct ksm_frame, elem);
+
+  if (a->checksum != b->checksum)
+    return a->checksum < b->checksum;
+  return memcmp (a->kpage, b->kpage, PGSIZE) < 0;
+}
+
+static unsigned
+candidate_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_entry (e, struct candidate, elem)->checksum;
+}
+
+static bool
+candidate_less (const struct hash_elem *a, const struct hash_elem *b,
+                void *aux UNUSED)
+{
+  return (hash_entry (a, struct candidate, elem)->checksum
+          < hash_entry (b, struct candidate, elem)->checksum);
+}
+
+static void
+candidate_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct candidate, elem));
+}
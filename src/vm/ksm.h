@@ -0,0 +1,21 @@
+#ifndef VM_KSM_H
+#define VM_KSM_H
+
+#include <hash.h>
+#include <stddef.h>
+
+/** A frame shared read-only, copy-on-write, by user pages whose
+   contents were found to be identical. */
+struct ksm_frame
+  {
+    void *kpage;                /**< Shared user-pool page. */
+    unsigned checksum;          /**< Hash of the page's contents. */
+    int ref_cnt;                /**< Number of pages sharing it. */
+    struct hash_elem elem;      /**< Element in the merged frame table. */
+  };
+
+void ksm_init (size_t scan_pages);
+void ksm_put (struct ksm_frame *);
+void ksm_print_stats (void);
+
+#endif /**< vm/ksm.h */
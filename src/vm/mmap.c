@@ -0,0 +1,143 @@
+#include "vm/mmap.h"
+#include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+static void mapping_free (struct mapping *);
+
+/** Creates a mapping of PAGE_CNT pages at BASE in the current
+   process, which takes ownership of FILE.  The pages themselves
+   are added by the caller.  Returns a null pointer if memory
+   allocation fails, in which case FILE is closed. */
+struct mapping *
+mapping_create (struct file *file, void *base, size_t page_cnt)
+{
+  struct mapping *m = malloc (sizeof *m);
+  if (m == NULL)
+    {
+      file_close (file);
+      return NULL;
+    }
+
+  m->id = -1;
+  m->file = file;
+  m->base = base;
+  m->page_cnt = page_cnt;
+  m->ra_prev = SIZE_MAX;
+  m->ra_start = 0;
+  m->ra_size = 0;
+  list_push_back (&thread_current ()->mappings, &m->elem);
+  return m;
+}
+
+/** Frees every mapping of the current process.  The pages that
+   refer to them must already have been destroyed. */
+void
+mapping_destroy_all (void)
+{
+  struct list *mappings = &thread_current ()->mappings;
+
+  while (!list_empty (mappings))
+    mapping_free (list_entry (list_pop_front (mappings),
+                              struct mapping, elem));
+}
+
+/** Maps FILE into the current process at ADDR.  Returns the new
+   map id, or -1 if ADDR is null or misaligned, FILE is empty, or
+   any page in the range is already in use. */
+int
+mmap_map (struct file *file, void *addr)
+{
+  struct thread *cur = thread_current ();
+  struct mapping *m;
+  off_t length;
+  size_t page_cnt, i;
+
+  if (addr == NULL || pg_ofs (addr) != 0)
+    return -1;
+  length = file_length (file);
+  if (length == 0)
+    return -1;
+
+  page_cnt = DIV_ROUND_UP (length, PGSIZE);
+  for (i = 0; i < page_cnt; i++)
+    {
+      void *upage = (uint8_t *) addr + i * PGSIZE;
+      if (!is_user_vaddr (upage) || page_lookup (cur, upage) != NULL)
+        return -1;
+    }
+
+  m = mapping_create (file_reopen (file), addr, page_cnt);
+  if (m == NULL || m->file == NULL)
+    goto fail;
+  m->id = cur->next_mapid++;
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      off_t ofs = i * PGSIZE;
+      size_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+      if (page_create_file ((uint8_t *) addr + ofs, m, ofs, read_bytes,
+                            true) == NULL)
+        goto fail;
+    }
+  return m->id;
+
+ fail:
+  if (m != NULL)
+    {
+      for (i = 0; i < page_cnt; i++)
+        {
+          struct page *p = page_lookup (cur, (uint8_t *) addr + i * PGSIZE);
+          if (p != NULL)
+            page_destroy (p);
+        }
+      list_remove (&m->elem);
+      mapping_free (m);
+    }
+  return -1;
+}
+
+/** Unmaps mapping ID of the current process, writing dirty pages
+   back to the file.  Returns false if there is no such mapping. */
+bool
+mmap_unmap (int id)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  for (e = list_begin (&cur->mappings); e != list_end (&cur->mappings);
+       e = list_next (e))
+    {
+      struct mapping *m = list_entry (e, struct mapping, elem);
+      if (m->id == id && id >= 0)
+        {
+          size_t i;
+
+          for (i = 0; i < m->page_cnt; i++)
+            {
+              struct page *p = page_lookup (cur, (uint8_t *) m->base
+                                                 + i * PGSIZE);
+              if (p != NULL && p->mapping == m)
+                page_destroy (p);
+            }
+          list_remove (&m->elem);
+          mapping_free (m);
+          return true;
+        }
+    }
+  return false;
+}
+
+/** Closes M's file and frees M. */
+static void
+mapping_free (struct mapping *m)
+{
+  file_close (m->file);
+  free (m);
+}
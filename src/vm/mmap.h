@@ -0,0 +1,36 @@
+#ifndef VM_MMAP_H
+#define VM_MMAP_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct file;
+
+/** A run of consecutive file-backed pages in one process, created
+   either for a segment of the process's executable or by the
+   mmap system call.  Each mapping keeps its own read-ahead state,
+   modeled on the Linux `file_ra_state', so that a sequential
+   scan through one mapping is recognized regardless of what the
+   process does elsewhere in its address space. */
+struct mapping
+  {
+    int id;                     /**< Map id, or -1 for an executable segment. */
+    struct file *file;          /**< Private handle on the mapped file. */
+    void *base;                 /**< First user page. */
+    size_t page_cnt;            /**< Number of pages. */
+    struct list_elem elem;      /**< Element in owner's mappings list. */
+
+    /* Read-ahead state, in page indexes relative to BASE. */
+    size_t ra_prev;             /**< Page of the last demand fault. */
+    size_t ra_start;            /**< First page of the current window. */
+    size_t ra_size;             /**< Pages in the current window, 0 if none. */
+  };
+
+struct mapping *mapping_create (struct file *, void *base, size_t page_cnt);
+void mapping_destroy_all (void);
+
+int mmap_map (struct file *, void *addr);
+bool mmap_unmap (int id);
+
+#endif /**< vm/mmap.h */
@@ -0,0 +1,809 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/ksm.h"
+#include "vm/mmap.h"
+#include "vm/swap.h"
+
+/** Read-ahead tuning.  A sequential fault pattern in a mapping
+   opens a window of RA_INIT_PAGES pages past the faulting page,
+   and each fault that lands just past the previous window doubles
+   it, up to RA_MAX_PAGES.  A fault anywhere else collapses the
+   window and only the aligned cluster of FAULT_AROUND_PAGES pages
+   around the fault is brought in.  Swapped-out pages whose slots
+   are adjacent to the faulting page's slot are read along with it,
+   up to SWAP_AROUND_PAGES in each direction.
+
+   Speculative pages are only ever placed in free frames: read-ahead
+   never evicts anything. */
+#define RA_INIT_PAGES 4
+#define RA_MAX_PAGES 32
+#define FAULT_AROUND_PAGES 4
+#define SWAP_AROUND_PAGES 4
+
+/** Maximum size of a user stack, in pages. */
+static size_t stack_limit;
+
+/** If true, each process's memory usage is printed when it exits.
+   Controlled by kernel command-line option "-memstat". */
+bool page_exit_stats;
+
+/** A page of zeros, mapped read-only in place of every PAGE_ZERO
+   page that has been read but not yet written. */
+static void *zero_page;
+
+/** Statistics. */
+static long long fault_cnt;         /**< # of pages faulted in on demand. */
+static long long ra_cnt;            /**< # of pages read speculatively. */
+static long long ra_hit_cnt;        /**< # of those later accessed. */
+static long long zero_map_cnt;      /**< # of zero page mappings made. */
+static long long zero_copy_cnt;     /**< # of those later written. */
+
+static unsigned page_hash (const struct hash_elem *, void *aux);
+static bool page_less (const struct hash_elem *, const struct hash_elem *,
+                       void *aux);
+static struct page *page_alloc (void *upage, enum page_type, bool writable);
+static void page_release (struct hash_elem *, void *aux);
+static bool page_in (struct page *, bool may_evict);
+static bool page_read (struct page *, void *kpage);
+static bool page_map_zero (struct page *);
+static bool is_stack_access (const void *uaddr, const void *esp);
+static void read_around (struct page *, enum page_type, size_t swap_slot);
+
+/** Sets up the shared zero page and limits user stacks to
+   STACK_PAGES pages, or to all of user memory if that is less. */
+void
+page_init (size_t stack_pages)
+{
+  if (stack_pages > (uintptr_t) PHYS_BASE / PGSIZE)
+    stack_pages = (uintptr_t) PHYS_BASE / PGSIZE;
+  stack_limit = stack_pages;
+  zero_page = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+}
+
+/** Initializes the current process's supplemental page table.
+   Returns false if memory allocation fails. */
+bool
+page_table_init (void)
+{
+  return hash_init (&thread_current ()->pages, page_hash, page_less, NULL);
+}
+
+/** Destroys the current process's supplemental page table,
+   writing back dirty mapped pages and releasing every frame and
+   swap slot it holds.  Must be called before the page directory
+   is destroyed. */
+void
+page_table_destroy (void)
+{
+  hash_destroy (&thread_current ()->pages, page_release);
+}
+
+/** Adds a page at UPAGE to the current process that reads as all
+   zeros until it is first written.  Returns the new page, or a
+   null pointer if UPAGE is already in use or memory allocation
+   fails. */
+struct page *
+page_create_zero (void *upage, bool writable)
+{
+  return page_alloc (upage, PAGE_ZERO, writable);
+}
+
+/** Adds a page at UPAGE to the current process whose first
+   READ_BYTES bytes come from offset OFS in mapping M's file and
+   whose remaining bytes are zero.  Returns the new page, or a
+   null pointer if UPAGE is already in use or memory allocation
+   fails. */
+struct page *
+page_create_file (void *upage, struct mapping *m, off_t ofs,
+                  size_t read_bytes, bool writable)
+{
+  struct page *p;
+
+  ASSERT (read_bytes <= PGSIZE);
+
+  p = page_alloc (upage, PAGE_FILE, writable);
+  if (p != NULL)
+    {
+      p->mapping = m;
+      p->file_ofs = ofs;
+      p->read_bytes = read_bytes;
+    }
+  return p;
+}
+
+/** Returns the page of thread T that contains UADDR, or a null
+   pointer if there is none. */
+struct page *
+page_lookup (struct thread *t, const void *uaddr)
+{
+  struct page p;
+  struct hash_elem *e;
+
+  if (!is_user_vaddr (uaddr))
+    return NULL;
+
+  p.upage = pg_round_down (uaddr);
+  e = hash_find (&t->pages, &p.hash_elem);
+  return e != NULL ? hash_entry (e, struct page, hash_elem) : NULL;
+}
+
+/** Removes P from the current process and frees it. */
+void
+page_destroy (struct page *p)
+{
+  ASSERT (p->owner == thread_current ());
+
+  hash_delete (&p->owner->pages, &p->hash_elem);
+  page_release (&p->hash_elem, NULL);
+}
+
+/** Brings in the page containing FAULT_ADDR for the current
+   process.  WRITE is true for a write access.  A read of a
+   zero-fill page only maps the shared zero page; the page gets a
+   frame of its own on its first write.  ESP is the process's user
+   stack pointer, used to grow the stack when FAULT_ADDR is just
+   below it.  Returns false if the address is not part of the
+   process's address space or the access is not permitted, in
+   which case the fault is a genuine error. */
+bool
+page_fault_in (void *fault_addr, bool write, void *esp)
+{
+  struct thread *cur = thread_current ();
+  struct page *p = page_lookup (cur, fault_addr);
+  enum page_type type;
+  size_t swap_slot;
+  unsigned *counter;
+  bool paged_in = false;
+  bool success = true;
+
+  if (p == NULL && is_stack_access (fault_addr, esp))
+    p = page_create_zero (pg_round_down (fault_addr), true);
+  if (p == NULL || (write && !p->writable))
+    return false;
+
+  lock_acquire (&p->lock);
+  type = p->type;
+  swap_slot = p->swap_slot;
+  if (p->frame != NULL)
+    counter = &cur->minor_faults;
+  else if (write && (p->ksm != NULL || p->zero_mapped))
+    counter = &cur->cow_faults;
+  else if (p->ksm != NULL || type == PAGE_ZERO)
+    counter = &cur->minor_faults;
+  else
+    counter = &cur->major_faults;
+
+  if (p->frame == NULL)
+    {
+      if (p->ksm != NULL && !write)
+        success = pagedir_set_page (p->owner->pagedir, p->upage,
+                                    p->ksm->kpage, false);
+      else if (type == PAGE_ZERO && !write)
+        success = page_map_zero (p);
+      else
+        {
+          success = paged_in = page_in (p, true);
+          if (success)
+            frame_unpin (p->frame);
+        }
+    }
+  lock_release (&p->lock);
+
+  if (success)
+    (*counter)++;
+  if (paged_in)
+    {
+      fault_cnt++;
+      read_around (p, type, swap_slot);
+    }
+  return success;
+}
+
+/** Makes P resident immediately, without waiting for a fault.
+   Returns false if no frame could be obtained. */
+bool
+page_load (struct page *p)
+{
+  bool success = true;
+
+  lock_acquire (&p->lock);
+  if (p->frame == NULL)
+    {
+      success = page_in (p, true);
+      if (success)
+        frame_unpin (p->frame);
+    }
+  lock_release (&p->lock);
+  return success;
+}
+
+/** Faults in and pins every page in the SIZE bytes starting at
+   UADDR, so that the kernel can access them without faulting, for
+   example while holding a device lock.  WRITE is true if the
+   kernel will write to the range.  Returns false, with nothing
+   pinned, if any page is missing or not writable as required. */
+bool
+page_pin_range (const void *uaddr, size_t size, bool write)
+{
+  struct thread *cur = thread_current ();
+  uint8_t *upage;
+  uint8_t *end = (uint8_t *) uaddr + size;
+
+  if (size == 0)
+    return true;
+
+  for (upage = pg_round_down (uaddr); upage < end; upage += PGSIZE)
+    {
+      struct page *p = page_lookup (cur, upage);
+      bool success = true;
+
+      if (p == NULL || (write && !p->writable))
+        success = false;
+      else
+        {
+          lock_acquire (&p->lock);
+          if (p->frame != NULL)
+            frame_pin (p->frame);
+          else if (p->ksm != NULL && !write)
+            {
+              /* Merged frames are never evicted. */
+            }
+          else if (p->type == PAGE_ZERO && !write)
+            success = page_map_zero (p);
+          else
+            success = page_in (p, true);
+          lock_release (&p->lock);
+        }
+
+      if (!success)
+        {
+          if (upage > (uint8_t *) pg_round_down (uaddr))
+            page_unpin_range (uaddr, upage - (uint8_t *) uaddr);
+          return false;
+        }
+    }
+  return true;
+}
+
+/** Unpins the pages pinned by page_pin_range(UADDR, SIZE). */
+void
+page_unpin_range (const void *uaddr, size_t size)
+{
+  struct thread *cur = thread_current ();
+  uint8_t *upage;
+  uint8_t *end = (uint8_t *) uaddr + size;
+
+  for (upage = pg_round_down (uaddr); upage < end; upage += PGSIZE)
+    {
+      struct page *p = page_lookup (cur, upage);
+      if (p != NULL && p->frame != NULL)
+        frame_unpin (p->frame);
+    }
+}
+
+/** Returns true if resident page P has been accessed since the
+   last call, and clears its accessed bit.  Called by the frame
+   table's clock hand with P's lock held. */
+bool
+page_accessed_recently (struct page *p)
+{
+  uint32_t *pd = p->owner->pagedir;
+
+  if (!pagedir_is_accessed (pd, p->upage))
+    return false;
+
+  pagedir_set_accessed (pd, p->upage, false);
+  if (p->read_ahead)
+    {
+      ra_hit_cnt++;
+      p->read_ahead = false;
+    }
+  return true;
+}
+
+/** Writes resident page P out to its backing store, if it has
+   been modified, and unmaps it.  Dirty private pages go to swap;
+   dirty pages of an mmap'd file go back to the file.  Called
+   with P's lock held and P's frame pinned.  Returns false if P
+   could not be written out, leaving it mapped. */
+bool
+page_evict (struct page *p)
+{
+  uint32_t *pd = p->owner->pagedir;
+  void *kpage = p->frame->kpage;
+  bool dirty;
+
+  /* Unmap first, so that the owner faults (and waits on P's lock)
+     instead of modifying the page while it is written out.  The
+     dirty bit survives in the not-present PTE. */
+  pagedir_clear_page (pd, p->upage);
+  dirty = pagedir_is_dirty (pd, p->upage);
+
+  if (p->type == PAGE_FILE && p->mapping->id >= 0)
+    {
+      if (dirty)
+        file_write_at (p->mapping->file, kpage, p->read_bytes, p->file_ofs);
+    }
+  else if (p->swap_slot != SWAP_NONE && !dirty)
+    {
+      /* Cleaned by page_clean() and not written since: the copy
+         in swap is current. */
+    }
+  else if (dirty || p->type == PAGE_SWAP)
+    {
+      size_t slot;
+
+      if (p->swap_slot != SWAP_NONE)
+        {
+          swap_free (p->swap_slot);
+          p->swap_slot = SWAP_NONE;
+        }
+      slot = swap_out (kpage);
+      if (slot == SWAP_NONE)
+        {
+          pagedir_set_page (pd, p->upage, kpage, p->writable);
+          pagedir_set_dirty (pd, p->upage, dirty);
+          return false;
+        }
+      p->type = PAGE_SWAP;
+      p->swap_slot = slot;
+    }
+
+  p->read_ahead = false;
+  p->frame = NULL;
+  return true;
+}
+
+/** Writes resident page P to its backing store if it has been
+   modified, but leaves it mapped, so that evicting it later takes
+   no write.  A private page keeps the swap slot it is written to
+   for as long as it stays clean.  Leaves alone a page accessed
+   since the clock hand last passed it, which is unlikely to be
+   evicted soon and likely to be written again.  Called with P's
+   lock held and P's frame pinned.  Returns true if P was
+   written. */
+bool
+page_clean (struct page *p)
+{
+  uint32_t *pd = p->owner->pagedir;
+  void *kpage = p->frame->kpage;
+  size_t slot;
+
+  if (!pagedir_is_dirty (pd, p->upage) || pagedir_is_accessed (pd, p->upage))
+    return false;
+
+  /* Clear the dirty bit before writing, so that a write by the
+     owner meanwhile leaves the page dirty again. */
+  pagedir_set_dirty (pd, p->upage, false);
+  if (p->type == PAGE_FILE && p->mapping->id >= 0)
+    {
+      file_write_at (p->mapping->file, kpage, p->read_bytes, p->file_ofs);
+      return true;
+    }
+
+  if (p->swap_slot != SWAP_NONE)
+    {
+      swap_free (p->swap_slot);
+      p->swap_slot = SWAP_NONE;
+    }
+  slot = swap_out (kpage);
+  if (slot == SWAP_NONE)
+    {
+      pagedir_set_dirty (pd, p->upage, true);
+      return false;
+    }
+  p->type = PAGE_SWAP;
+  p->swap_slot = slot;
+  return true;
+}
+
+/** Tallies thread T's pages into *U.  The result is a snapshot:
+   pages may be evicted or faulted in while it is taken. */
+void
+page_get_usage (struct thread *t, struct page_usage *u)
+{
+  struct hash_iterator i;
+
+  u->resident = u->shared = u->swapped = u->file = 0;
+  hash_first (&i, &t->pages);
+  while (hash_next (&i))
+    {
+      struct page *p = hash_entry (hash_cur (&i), struct page, hash_elem);
+
+      if (p->frame != NULL)
+        {
+          u->resident++;
+          if (p->type == PAGE_FILE)
+            u->file++;
+        }
+      else if (p->ksm != NULL || p->zero_mapped)
+        u->shared++;
+      else if (p->type == PAGE_SWAP && p->swap_slot != SWAP_NONE)
+        u->swapped++;
+    }
+}
+
+/** Prints the current process's memory usage and fault counts. */
+void
+page_print_usage (void)
+{
+  struct thread *cur = thread_current ();
+  struct page_usage u;
+
+  page_get_usage (cur, &u);
+  printf ("%s: %zu resident, %zu shared, %zu swapped, %zu file pages; "
+          "%u minor, %u major, %u copy-on-write faults\n",
+          cur->name, u.resident, u.shared, u.swapped, u.file,
+          cur->minor_faults, cur->major_faults, cur->cow_faults);
+}
+
+/** Prints paging statistics. */
+void
+page_print_stats (void)
+{
+  printf ("Paging: %lld demand faults, %lld pages read ahead, "
+          "%lld read-ahead hits\n", fault_cnt, ra_cnt, ra_hit_cnt);
+  printf ("Paging: %lld zero page mappings, %lld copied on write\n",
+          zero_map_cnt, zero_copy_cnt);
+}
+
+/** Returns true if an access to UADDR, with the user stack pointer
+   at ESP, should grow the stack.  PUSHA checks access up to 32
+   bytes below the stack pointer before it moves it. */
+static bool
+is_stack_access (const void *uaddr, const void *esp)
+{
+  return (is_user_vaddr (uaddr)
+          && (const uint8_t *) uaddr >= (const uint8_t *) esp - 32
+          && (const uint8_t *) uaddr >= (uint8_t *) PHYS_BASE
+                                        - stack_limit * PGSIZE);
+}
+
+/** Allocates a page of the given TYPE at UPAGE and adds it to the
+   current process's page table. */
+static struct page *
+page_alloc (void *upage, enum page_type type, bool writable)
+{
+  struct thread *cur = thread_current ();
+  struct page *p;
+
+  ASSERT (pg_ofs (upage) == 0);
+
+  if (!is_user_vaddr (upage))
+    return NULL;
+
+  p = malloc (sizeof *p);
+  if (p == NULL)
+    return NULL;
+
+  p->upage = upage;
+  p->owner = cur;
+  p->type = type;
+  p->writable = writable;
+  p->read_ahead = false;
+  p->zero_mapped = false;
+  lock_init (&p->lock);
+  p->frame = NULL;
+  p->ksm = NULL;
+  p->mapping = NULL;
+  p->file_ofs = 0;
+  p->read_bytes = 0;
+  p->swap_slot = SWAP_NONE;
+
+  if (hash_insert (&cur->pages, &p->hash_elem) != NULL)
+    {
+      free (p);
+      return NULL;
+    }
+  return p;
+}
+
+/** Frees the page containing hash element E, which has already
+   been removed from its page table (or whose table is being
+   destroyed). */
+static void
+page_release (struct hash_elem *e, void *aux UNUSED)
+{
+  struct page *p = hash_entry (e, struct page, hash_elem);
+  uint32_t *pd = p->owner->pagedir;
+
+  lock_acquire (&p->lock);
+  if (p->frame != NULL)
+    {
+      if (p->type == PAGE_FILE && p->mapping->id >= 0
+          && pagedir_is_dirty (pd, p->upage))
+        file_write_at (p->mapping->file, p->frame->kpage, p->read_bytes,
+                       p->file_ofs);
+      if (p->read_ahead && pagedir_is_accessed (pd, p->upage))
+        ra_hit_cnt++;
+      pagedir_clear_page (pd, p->upage);
+      frame_free (p->frame);
+      if (p->swap_slot != SWAP_NONE)
+        swap_free (p->swap_slot);
+    }
+  else if (p->ksm != NULL)
+    {
+      pagedir_clear_page (pd, p->upage);
+      ksm_put (p->ksm);
+    }
+  else if (p->zero_mapped)
+    pagedir_clear_page (pd, p->upage);
+  else if (p->type == PAGE_SWAP && p->swap_slot != SWAP_NONE)
+    swap_free (p->swap_slot);
+  lock_release (&p->lock);
+
+  free (p);
+}
+
+/** Reads P's contents into a new frame and maps it.  Called with
+   P's lock held and P not resident.  A page that maps a merged
+   frame gets a private copy of it.  If MAY_EVICT is false, only a
+   free frame is used.  On success the frame is left pinned. */
+static bool
+page_in (struct page *p, bool may_evict)
+{
+  struct frame *f;
+  void *kpage;
+
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (p->frame == NULL);
+
+  f = frame_alloc (p, may_evict);
+  if (f == NULL)
+    return false;
+  kpage = f->kpage;
+
+  if (p->zero_mapped)
+    {
+      pagedir_clear_page (p->owner->pagedir, p->upage);
+      p->zero_mapped = false;
+      zero_copy_cnt++;
+    }
+
+  if (p->ksm != NULL)
+    {
+      memcpy (kpage, p->ksm->kpage, PGSIZE);
+      pagedir_clear_page (p->owner->pagedir, p->upage);
+      ksm_put (p->ksm);
+      p->ksm = NULL;
+    }
+  else if (!page_read (p, kpage))
+    {
+      frame_free (f);
+      return false;
+    }
+
+  if (!pagedir_set_page (p->owner->pagedir, p->upage, kpage, p->writable))
+    {
+      frame_free (f);
+      return false;
+    }
+  p->frame = f;
+  return true;
+}
+
+/** Reads P's contents from its backing store into KPAGE. */
+static bool
+page_read (struct page *p, void *kpage)
+{
+  switch (p->type)
+    {
+    case PAGE_ZERO:
+      memset (kpage, 0, PGSIZE);
+      return true;
+
+    case PAGE_FILE:
+      if (file_read_at (p->mapping->file, kpage, p->read_bytes,
+                        p->file_ofs) != (off_t) p->read_bytes)
+        return false;
+      memset ((uint8_t *) kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+      return true;
+
+    case PAGE_SWAP:
+      swap_in (p->swap_slot, kpage);
+      p->swap_slot = SWAP_NONE;
+      return true;
+
+    default:
+      NOT_REACHED ();
+    }
+}
+
+/** Maps the shared zero page read-only at P's address, if it is
+   not mapped there already.  Called with P's lock held, for a
+   PAGE_ZERO page without a frame. */
+static bool
+page_map_zero (struct page *p)
+{
+  ASSERT (lock_held_by_current_thread (&p->lock));
+  ASSERT (p->type == PAGE_ZERO && p->frame == NULL);
+
+  if (!p->zero_mapped)
+    {
+      if (!pagedir_set_page (p->owner->pagedir, p->upage, zero_page, false))
+        return false;
+      p->zero_mapped = true;
+      zero_map_cnt++;
+    }
+  return true;
+}
+
+/** Speculatively brings in page Q of the current process, which
+   must not be resident, using only a free frame.  Returns false
+   if no free frame is available.  Skips Q, returning true, if
+   someone else holds its lock. */
+static bool
+page_in_ahead (struct page *q)
+{
+  bool success = true;
+
+  if (!lock_try_acquire (&q->lock))
+    return true;
+  if (q->frame == NULL)
+    {
+      success = page_in (q, false);
+      if (success)
+        {
+          q->read_ahead = true;
+          ra_cnt++;
+          frame_unpin (q->frame);
+        }
+    }
+  lock_release (&q->lock);
+  return success;
+}
+
+/** Updates the read-ahead state of P's mapping for a demand fault
+   on P and returns the range of pages to bring in alongside it
+   in *START and *CNT, as page indexes within the mapping. */
+static void
+file_ra_update (struct page *p, size_t *start, size_t *cnt)
+{
+  struct mapping *m = p->mapping;
+  size_t idx = pg_no (p->upage) - pg_no (m->base);
+
+  if (m->ra_size > 0 && idx == m->ra_start + m->ra_size)
+    {
+      /* Ran off the end of the previous window: the scan is
+         still sequential, so read further ahead next time. */
+      m->ra_size *= 2;
+      if (m->ra_size > RA_MAX_PAGES)
+        m->ra_size = RA_MAX_PAGES;
+    }
+  else if (m->ra_size > 0 && idx >= m->ra_start
+           && idx < m->ra_start + m->ra_size)
+    {
+      /* Inside the window: some of it was never read (free frames
+         ran out) or has already been evicted.  Keep the size. */
+    }
+  else if (idx == m->ra_prev + 1)
+    m->ra_size = RA_INIT_PAGES;
+  else
+    m->ra_size = 0;
+  m->ra_prev = idx;
+
+  if (m->ra_size > 0)
+    {
+      m->ra_start = idx + 1;
+      *start = m->ra_start;
+      *cnt = m->ra_size;
+    }
+  else
+    {
+      *start = idx & ~(size_t) (FAULT_AROUND_PAGES - 1);
+      *cnt = FAULT_AROUND_PAGES;
+    }
+}
+
+/** Returns page IDX of the mapping of P, which was just faulted
+   in, if it is a file page that read-around should bring in, or
+   a null pointer otherwise. */
+static struct page *
+file_ra_candidate (struct page *p, size_t idx)
+{
+  struct mapping *m = p->mapping;
+  struct page *q = page_lookup (p->owner, (uint8_t *) m->base
+                                          + idx * PGSIZE);
+
+  if (q == p || q == NULL || q->mapping != m
+      || q->type != PAGE_FILE || q->frame != NULL || q->ksm != NULL)
+    return NULL;
+  return q;
+}
+
+/** Brings in pages near P, which was just faulted in and whose
+   backing store was TYPE (and SWAP_SLOT, for swap), if they are
+   likely to be needed soon and cheap to read now. */
+static void
+read_around (struct page *p, enum page_type type, size_t swap_slot)
+{
+  struct thread *cur = thread_current ();
+
+  if (type == PAGE_FILE)
+    {
+      struct mapping *m = p->mapping;
+      size_t start, cnt, i;
+
+      struct inode *inode = file_get_inode (m->file);
+      off_t ra_ofs = 0, ra_end = 0;
+
+      /* Queue the whole window to be read into the buffer cache in
+         the background first, merging contiguous pages into one
+         range, so that the disk works through it in large requests
+         while the pages are copied in one at a time. */
+      file_ra_update (p, &start, &cnt);
+      for (i = start; i < start + cnt && i < m->page_cnt; i++)
+        {
+          struct page *q = file_ra_candidate (p, i);
+          if (q == NULL)
+            continue;
+          if (q->file_ofs != ra_end)
+            {
+              if (ra_end > ra_ofs)
+                inode_read_ahead (inode, ra_ofs, ra_end);
+              ra_ofs = q->file_ofs;
+            }
+          ra_end = q->file_ofs + q->read_bytes;
+        }
+      if (ra_end > ra_ofs)
+        inode_read_ahead (inode, ra_ofs, ra_end);
+
+      for (i = start; i < start + cnt && i < m->page_cnt; i++)
+        {
+          struct page *q = file_ra_candidate (p, i);
+          if (q != NULL && !page_in_ahead (q))
+            break;
+        }
+    }
+  else if (type == PAGE_SWAP)
+    {
+      /* Pages evicted together usually went to consecutive slots.
+         Follow the run of such neighbours in each direction. */
+      int dir;
+
+      for (dir = -1; dir <= 1; dir += 2)
+        {
+          int d;
+
+          for (d = 1; d <= SWAP_AROUND_PAGES; d++)
+            {
+              uint8_t *upage = (uint8_t *) p->upage + dir * d * PGSIZE;
+              struct page *q = page_lookup (cur, upage);
+              if (q == NULL || q->type != PAGE_SWAP || q->frame != NULL
+                  || q->ksm != NULL || q->swap_slot != swap_slot + dir * d)
+                break;
+              if (!page_in_ahead (q))
+                return;
+            }
+        }
+    }
+}
+
+/** Returns a hash value for page E. */
+static unsigned
+page_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct page *p = hash_entry (e, struct page, hash_elem);
+  return hash_bytes (&p->upage, sizeof p->upage);
+}
+
+/** Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
+{
+  const struct page *pa = hash_entry (a, struct page, hash_elem);
+  const struct page *pb = hash_entry (b, struct page, hash_elem);
+  return pa->upage < pb->upage;
+}
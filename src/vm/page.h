@@ -0,0 +1,87 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+struct frame;
+struct ksm_frame;
+struct mapping;
+struct thread;
+
+/** Where a page's contents come from when it is not resident. */
+enum page_type
+  {
+    PAGE_ZERO,                  /**< All zeros until first written. */
+    PAGE_FILE,                  /**< Read from a range of a mapped file. */
+    PAGE_SWAP                   /**< Anonymous, lives in swap when evicted. */
+  };
+
+/** A user virtual page.  One entry in a process's supplemental
+   page table, which records everything needed to bring the page
+   back in after it has been evicted or before it is first
+   touched. */
+struct page
+  {
+    void *upage;                /**< User virtual address. */
+    struct thread *owner;       /**< Process that owns the page. */
+    enum page_type type;        /**< Backing store. */
+    bool writable;              /**< False for read-only pages. */
+    bool read_ahead;            /**< Brought in speculatively, not yet used. */
+    bool zero_mapped;           /**< Shared zero page mapped read-only. */
+    struct lock lock;           /**< Serializes page-in, eviction, teardown. */
+    struct frame *frame;        /**< Frame holding the page, or NULL. */
+    struct ksm_frame *ksm;      /**< Merged frame mapped instead, or NULL. */
+
+    /* PAGE_FILE only. */
+    struct mapping *mapping;    /**< Mapping the page belongs to. */
+    off_t file_ofs;             /**< Offset of the page in the file. */
+    size_t read_bytes;          /**< Bytes to read; the rest is zeroed. */
+
+    /* PAGE_SWAP only. */
+    size_t swap_slot;           /**< Swap slot, or SWAP_NONE.  A resident
+                                   page has one only while the copy
+                                   page_clean() wrote there is current. */
+
+    struct hash_elem hash_elem; /**< Element in owner's page table. */
+  };
+
+/** Memory usage of a process. */
+struct page_usage
+  {
+    size_t resident;            /**< Pages in frames of their own. */
+    size_t shared;              /**< Pages mapping the zero page or a
+                                   merged frame. */
+    size_t swapped;             /**< Pages in swap. */
+    size_t file;                /**< Resident pages read from a file. */
+  };
+
+extern bool page_exit_stats;
+
+void page_init (size_t stack_pages);
+bool page_table_init (void);
+void page_table_destroy (void);
+
+struct page *page_create_zero (void *upage, bool writable);
+struct page *page_create_file (void *upage, struct mapping *, off_t ofs,
+                               size_t read_bytes, bool writable);
+struct page *page_lookup (struct thread *, const void *uaddr);
+void page_destroy (struct page *);
+
+bool page_fault_in (void *fault_addr, bool write, void *esp);
+bool page_load (struct page *);
+bool page_pin_range (const void *uaddr, size_t size, bool write);
+void page_unpin_range (const void *uaddr, size_t size);
+
+bool page_accessed_recently (struct page *);
+bool page_evict (struct page *);
+bool page_clean (struct page *);
+
+void page_get_usage (struct thread *, struct page_usage *);
+void page_print_usage (void);
+void page_print_stats (void);
+
+#endif /**< vm/page.h */
@@ -0,0 +1,85 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/zswap.h"
+
+/** Number of sectors in a page-sized swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block *swap_device;   /**< Swap partition, or NULL. */
+static struct bitmap *swap_map;     /**< One bit per slot, true if in use. */
+static struct lock swap_lock;       /**< Protects swap_map. */
+
+/** Locates the swap device and sets up the slot map.
+   Without a swap device, every swap_out() fails. */
+void
+swap_init (void)
+{
+  size_t slot_cnt = 0;
+
+  lock_init (&swap_lock);
+  swap_device = block_get_role (BLOCK_SWAP);
+  if (swap_device != NULL)
+    slot_cnt = block_size (swap_device) / SECTORS_PER_SLOT;
+  else
+    printf ("swap: no swap device, paging to swap disabled\n");
+
+  swap_map = bitmap_create (slot_cnt);
+  if (swap_map == NULL)
+    PANIC ("swap: bitmap creation failed");
+}
+
+/** Assigns the page at KPAGE a free swap slot and saves it there,
+   or in the compressed swap cache if that will take it.  Returns
+   the slot, or SWAP_NONE if swap is full. */
+size_t
+swap_out (const void *kpage)
+{
+  size_t slot;
+
+  lock_acquire (&swap_lock);
+  slot = bitmap_scan_and_flip (swap_map, 0, 1, false);
+  lock_release (&swap_lock);
+  if (slot == BITMAP_ERROR)
+    return SWAP_NONE;
+
+  if (!zswap_store (slot, kpage))
+    swap_write_slot (slot, kpage);
+  return slot;
+}
+
+/** Writes the page at KPAGE to SLOT on the swap device. */
+void
+swap_write_slot (size_t slot, const void *kpage)
+{
+  block_write_multiple (swap_device, slot * SECTORS_PER_SLOT,
+                        SECTORS_PER_SLOT, kpage);
+}
+
+/** Reads SLOT into the page at KPAGE and releases the slot. */
+void
+swap_in (size_t slot, void *kpage)
+{
+  ASSERT (slot != SWAP_NONE);
+  ASSERT (bitmap_test (swap_map, slot));
+
+  if (!zswap_load (slot, kpage))
+    block_read_multiple (swap_device, slot * SECTORS_PER_SLOT,
+                         SECTORS_PER_SLOT, kpage);
+  swap_free (slot);
+}
+
+/** Releases SLOT without reading it. */
+void
+swap_free (size_t slot)
+{
+  zswap_invalidate (slot);
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_map, slot));
+  bitmap_reset (swap_map, slot);
+  lock_release (&swap_lock);
+}
@@ -0,0 +1,538 @@
+#include "vm/zswap.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/swap.h"
+
+/** Compressed swap cache.
+
+   Pages on their way to swap are compressed and kept in a pool of
+   kernel pages instead of being written to the swap device.  Each
+   compressed page keeps the swap slot it was assigned, so when the
+   pool fills up the oldest entries are decompressed and written to
+   their slots, making room.  Pages that do not compress to
+   MAX_STORE_SIZE or less bypass the pool entirely.
+
+   The pool is carved into CHUNK_SIZE-byte chunks, and a compressed
+   page occupies a run of consecutive chunks within a single pool
+   page.
+
+   Writing an entry back takes it off the LRU list and frees its
+   chunks at once, but leaves it in ENTRIES, marked as writing,
+   until the disk write completes, so that zswap_lock need not be
+   held across the write.  Meanwhile a load or invalidation of its
+   slot waits, since the slot's data is in neither place. */
+
+#define CHUNK_SIZE 64                           /**< Allocation unit. */
+#define CHUNKS_PER_PAGE (PGSIZE / CHUNK_SIZE)   /**< Must be at most 64. */
+#define MAX_STORE_SIZE (PGSIZE * 3 / 4)         /**< Largest size kept. */
+
+/** A page of the pool. */
+struct zpage
+  {
+    uint8_t *data;              /**< Kernel page holding the chunks. */
+    uint64_t used;              /**< Bit N set if chunk N is in use. */
+    struct list_elem elem;      /**< Element in pool_pages. */
+  };
+
+/** A compressed page. */
+struct zentry
+  {
+    size_t slot;                /**< Swap slot the page belongs to. */
+    struct zpage *zpage;        /**< Pool page holding the data. */
+    unsigned first_chunk;       /**< First chunk in ZPAGE. */
+    unsigned chunk_cnt;         /**< Number of chunks. */
+    size_t size;                /**< Compressed size in bytes. */
+    bool writing;               /**< Being written back to the slot? */
+    struct hash_elem hash_elem; /**< Element in entries. */
+    struct list_elem lru_elem;  /**< Element in lru, oldest first. */
+  };
+
+static struct lock zswap_lock;      /**< Protects the members below. */
+static struct condition written;    /**< Signaled when a writeback ends. */
+static size_t max_pages;            /**< Pool size limit, 0 if disabled. */
+static struct list pool_pages;      /**< All pool pages. */
+static size_t pool_page_cnt;        /**< Number of pages in pool_pages. */
+static struct hash entries;         /**< Compressed pages, by slot. */
+static struct list lru;             /**< Compressed pages, oldest first. */
+
+/** Serializes stores, which alone use the buffers below.  Taken
+   before zswap_lock and held across writebacks. */
+static struct lock store_lock;
+static uint8_t *writeback_page;     /**< Decompression buffer. */
+static uint8_t compress_buf[MAX_STORE_SIZE];
+
+/** Statistics. */
+static long long store_cnt;         /**< # of pages stored compressed. */
+static long long reject_cnt;        /**< # of pages that did not fit. */
+static long long hit_cnt;           /**< # of pages loaded from the pool. */
+static long long writeback_cnt;     /**< # of pages written to disk. */
+static unsigned long long stored_bytes;   /**< Compressed bytes stored. */
+
+static size_t lz_compress (const uint8_t *, size_t, uint8_t *, size_t cap);
+static bool lz_decompress (const uint8_t *, size_t, uint8_t *, size_t);
+static bool pool_alloc (unsigned chunk_cnt, struct zpage **, unsigned *first);
+static bool writeback_oldest (void);
+static void entry_release_chunks (struct zentry *);
+static void entry_remove (struct zentry *);
+static struct zentry *entry_find (size_t slot);
+static struct zentry *entry_find_settled (size_t slot);
+static hash_hash_func entry_hash;
+static hash_less_func entry_less;
+
+/** Initializes the compressed swap cache with room for up to
+   POOL_PAGES kernel pages of compressed data.  A POOL_PAGES of 0
+   leaves the cache disabled, so that every page goes straight to
+   the swap device. */
+void
+zswap_init (size_t pool_pages_)
+{
+  lock_init (&zswap_lock);
+  cond_init (&written);
+  lock_init (&store_lock);
+  list_init (&pool_pages);
+  list_init (&lru);
+  if (pool_pages_ == 0)
+    return;
+
+  if (!hash_init (&entries, entry_hash, entry_less, NULL))
+    PANIC ("zswap: hash table creation failed");
+  writeback_page = palloc_get_page (PAL_ASSERT);
+  max_pages = pool_pages_;
+  printf ("zswap: compressed swap cache of up to %zu pages\n", max_pages);
+}
+
+/** Tries to keep a compressed copy of KPAGE for swap slot SLOT
+   instead of writing it to disk.  Returns false if the cache is
+   disabled or the page does not compress well enough, in which
+   case the caller must write the page to SLOT itself. */
+bool
+zswap_store (size_t slot, const void *kpage)
+{
+  struct zentry *e;
+  struct zpage *zp;
+  unsigned first, chunk_cnt;
+  size_t size;
+
+  if (max_pages == 0)
+    return false;
+
+  lock_acquire (&store_lock);
+  size = lz_compress (kpage, PGSIZE, compress_buf, sizeof compress_buf);
+  e = size > 0 ? malloc (sizeof *e) : NULL;
+  lock_acquire (&zswap_lock);
+  if (e == NULL)
+    goto reject;
+
+  chunk_cnt = DIV_ROUND_UP (size, CHUNK_SIZE);
+  while (!pool_alloc (chunk_cnt, &zp, &first))
+    if (!writeback_oldest ())
+      {
+        free (e);
+        goto reject;
+      }
+
+  memcpy (zp->data + first * CHUNK_SIZE, compress_buf, size);
+  e->slot = slot;
+  e->zpage = zp;
+  e->first_chunk = first;
+  e->chunk_cnt = chunk_cnt;
+  e->size = size;
+  e->writing = false;
+  hash_insert (&entries, &e->hash_elem);
+  list_push_back (&lru, &e->lru_elem);
+
+  store_cnt++;
+  stored_bytes += size;
+  lock_release (&zswap_lock);
+  lock_release (&store_lock);
+  return true;
+
+ reject:
+  reject_cnt++;
+  lock_release (&zswap_lock);
+  lock_release (&store_lock);
+  return false;
+}
+
+/** If SLOT's page is in the cache, decompresses it into KPAGE,
+   drops it from the cache, and returns true.  Otherwise returns
+   false, and the page must be read from disk. */
+bool
+zswap_load (size_t slot, void *kpage)
+{
+  struct zentry *e;
+
+  if (max_pages == 0)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  e = entry_find_settled (slot);
+  if (e != NULL)
+    {
+      if (!lz_decompress (e->zpage->data + e->first_chunk * CHUNK_SIZE,
+                          e->size, kpage, PGSIZE))
+        PANIC ("zswap: corrupt entry for slot %zu", slot);
+      entry_remove (e);
+      hit_cnt++;
+    }
+  lock_release (&zswap_lock);
+  return e != NULL;
+}
+
+/** Drops SLOT's page from the cache, if present. */
+void
+zswap_invalidate (size_t slot)
+{
+  struct zentry *e;
+
+  if (max_pages == 0)
+    return;
+
+  lock_acquire (&zswap_lock);
+  e = entry_find_settled (slot);
+  if (e != NULL)
+    entry_remove (e);
+  lock_release (&zswap_lock);
+}
+
+/** Prints compressed swap cache statistics. */
+void
+zswap_print_stats (void)
+{
+  if (max_pages == 0)
+    return;
+
+  printf ("Zswap: %lld pages stored, %lld rejected, %lld hits, "
+          "%lld writebacks, %llu%% average compressed size\n",
+          store_cnt, reject_cnt, hit_cnt, writeback_cnt,
+          store_cnt > 0 ? stored_bytes * 100 / (store_cnt * PGSIZE) : 0);
+}
+
+/** Finds CHUNK_CNT consecutive free chunks in the pool, adding a
+   pool page if there is no room and the pool may still grow.
+   On success, stores the pool page and first chunk in *ZPP and
+   *FIRST and marks the chunks used. */
+static bool
+pool_alloc (unsigned chunk_cnt, struct zpage **zpp, unsigned *first)
+{
+  uint64_t mask = (chunk_cnt == 64 ? (uint64_t) -1
+                   : ((uint64_t) 1 << chunk_cnt) - 1);
+  struct list_elem *e;
+  struct zpage *zp;
+  unsigned i;
+
+  ASSERT (chunk_cnt > 0 && chunk_cnt <= CHUNKS_PER_PAGE);
+
+  for (e = list_begin (&pool_pages); e != list_end (&pool_pages);
+       e = list_next (e))
+    {
+      zp = list_entry (e, struct zpage, elem);
+      for (i = 0; i + chunk_cnt <= CHUNKS_PER_PAGE; i++)
+        if ((zp->used & (mask << i)) == 0)
+          goto found;
+    }
+
+  if (pool_page_cnt >= max_pages)
+    return false;
+  zp = malloc (sizeof *zp);
+  if (zp == NULL)
+    return false;
+  zp->data = palloc_get_page (0);
+  if (zp->data == NULL)
+    {
+      free (zp);
+      return false;
+    }
+  zp->used = 0;
+  list_push_back (&pool_pages, &zp->elem);
+  pool_page_cnt++;
+  i = 0;
+
+ found:
+  zp->used |= mask << i;
+  *zpp = zp;
+  *first = i;
+  return true;
+}
+
+/** Writes the oldest compressed page to its swap slot and drops
+   it from the cache, freeing its chunks.  Releases zswap_lock for
+   the duration of the write.  The caller must hold store_lock and
+   zswap_lock.  Returns false if the cache is empty. */
+static bool
+writeback_oldest (void)
+{
+  struct zentry *e;
+
+  ASSERT (lock_held_by_current_thread (&store_lock));
+  ASSERT (lock_held_by_current_thread (&zswap_lock));
+
+  if (list_empty (&lru))
+    return false;
+
+  e = list_entry (list_pop_front (&lru), struct zentry, lru_elem);
+  if (!lz_decompress (e->zpage->data + e->first_chunk * CHUNK_SIZE,
+                      e->size, writeback_page, PGSIZE))
+    PANIC ("zswap: corrupt entry for slot %zu", e->slot);
+  entry_release_chunks (e);
+  e->writing = true;
+  lock_release (&zswap_lock);
+
+  swap_write_slot (e->slot, writeback_page);
+
+  lock_acquire (&zswap_lock);
+  hash_delete (&entries, &e->hash_elem);
+  free (e);
+  writeback_cnt++;
+  cond_broadcast (&written, &zswap_lock);
+  return true;
+}
+
+/** Releases E's chunks, returning its pool page to the kernel once
+   that page is empty. */
+static void
+entry_release_chunks (struct zentry *e)
+{
+  struct zpage *zp = e->zpage;
+  uint64_t mask = (e->chunk_cnt == 64 ? (uint64_t) -1
+                   : ((uint64_t) 1 << e->chunk_cnt) - 1);
+
+  zp->used &= ~(mask << e->first_chunk);
+  if (zp->used == 0)
+    {
+      list_remove (&zp->elem);
+      palloc_free_page (zp->data);
+      free (zp);
+      pool_page_cnt--;
+    }
+  e->zpage = NULL;
+}
+
+/** Removes E, which must not be writing, from the cache, releasing
+   its chunks, and frees it. */
+static void
+entry_remove (struct zentry *e)
+{
+  ASSERT (!e->writing);
+
+  hash_delete (&entries, &e->hash_elem);
+  list_remove (&e->lru_elem);
+  entry_release_chunks (e);
+  free (e);
+}
+
+/** Returns the cache entry for SLOT, or a null pointer. */
+static struct zentry *
+entry_find (size_t slot)
+{
+  struct zentry key;
+  struct hash_elem *e;
+
+  key.slot = slot;
+  e = hash_find (&entries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct zentry, hash_elem) : NULL;
+}
+
+/** Returns the cache entry for SLOT, or a null pointer, first
+   waiting for any writeback of SLOT to finish.  The caller must
+   hold zswap_lock. */
+static struct zentry *
+entry_find_settled (size_t slot)
+{
+  struct zentry *e;
+
+  while ((e = entry_find (slot)) != NULL && e->writing)
+    cond_wait (&written, &zswap_lock);
+  return e;
+}
+
+static unsigned
+entry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct zentry *z = hash_entry (e, struct zentry, hash_elem);
+  return hash_int (z->slot);
+}
+
+static bool
+entry_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct zentry, hash_elem)->slot
+          < hash_entry (b, struct zentry, hash_elem)->slot);
+}
+
+/** LZ77 compression in the style of the LZ4 block format.
+
+   The output is a series of sequences.  Each starts with a token
+   byte whose high nibble is a count of literal bytes and whose low
+   nibble is a match length minus MIN_MATCH; a nibble of 15 is
+   continued by further bytes that are added on, stopping after
+   the first byte that is not 255.  The literals follow, then a
+   2-byte little-endian distance back to the start of the match.
+   The final sequence may consist of literals only. */
+
+#define MIN_MATCH 4
+#define HASH_BITS 12
+#define NO_POS 0xffff
+
+/** Most recent position of each hashed 4-byte sequence. */
+static uint16_t lz_table[1 << HASH_BITS];
+
+static uint32_t
+read32 (const uint8_t *p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof v);
+  return v;
+}
+
+/** Appends the continuation bytes for length LEN (already reduced
+   by 15) to DST at *OP.  Returns false if CAP would be exceeded. */
+static bool
+put_length (uint8_t *dst, size_t *op, size_t cap, size_t len)
+{
+  for (;;)
+    {
+      if (*op >= cap)
+        return false;
+      dst[(*op)++] = len >= 255 ? 255 : len;
+      if (len < 255)
+        return true;
+      len -= 255;
+    }
+}
+
+/** Appends a sequence of LIT_LEN literals from LIT followed by a
+   match of MATCH_LEN bytes at distance OFFSET, or no match if
+   MATCH_LEN is 0. */
+static bool
+put_sequence (uint8_t *dst, size_t *op, size_t cap, const uint8_t *lit,
+              size_t lit_len, size_t offset, size_t match_len)
+{
+  size_t code = match_len > 0 ? match_len - MIN_MATCH : 0;
+
+  if (*op >= cap)
+    return false;
+  dst[(*op)++] = (lit_len < 15 ? lit_len : 15) << 4 | (code < 15 ? code : 15);
+  if (lit_len >= 15 && !put_length (dst, op, cap, lit_len - 15))
+    return false;
+  if (cap - *op < lit_len)
+    return false;
+  memcpy (dst + *op, lit, lit_len);
+  *op += lit_len;
+
+  if (match_len == 0)
+    return true;
+  if (cap - *op < 2)
+    return false;
+  dst[(*op)++] = offset & 0xff;
+  dst[(*op)++] = offset >> 8;
+  return code < 15 || put_length (dst, op, cap, code - 15);
+}
+
+/** Compresses the LEN bytes at SRC into DST, which has room for
+   CAP bytes.  Returns the compressed size, or 0 if it would exceed
+   CAP. */
+static size_t
+lz_compress (const uint8_t *src, size_t len, uint8_t *dst, size_t cap)
+{
+  size_t ip = 0, anchor = 0, op = 0;
+
+  ASSERT (len < NO_POS);
+
+  memset (lz_table, 0xff, sizeof lz_table);
+  while (ip + MIN_MATCH <= len)
+    {
+      uint32_t seq = read32 (src + ip);
+      unsigned h = (seq * 2654435761u) >> (32 - HASH_BITS);
+      size_t ref = lz_table[h];
+
+      lz_table[h] = ip;
+      if (ref != NO_POS && read32 (src + ref) == seq)
+        {
+          size_t match_len = MIN_MATCH;
+          while (ip + match_len < len
+                 && src[ref + match_len] == src[ip + match_len])
+            match_len++;
+          if (!put_sequence (dst, &op, cap, src + anchor, ip - anchor,
+                             ip - ref, match_len))
+            return 0;
+          ip += match_len;
+          anchor = ip;
+        }
+      else
+        ip++;
+    }
+
+  if (anchor < len
+      && !put_sequence (dst, &op, cap, src + anchor, len - anchor, 0, 0))
+    return 0;
+  return op;
+}
+
+/** Reads continuation bytes at SRC[*IP] into *LEN. */
+static bool
+get_length (const uint8_t *src, size_t *ip, size_t len, size_t *n)
+{
+  uint8_t b;
+
+  do
+    {
+      if (*ip >= len)
+        return false;
+      b = src[(*ip)++];
+      *n += b;
+    }
+  while (b == 255);
+  return true;
+}
+
+/** Decompresses the LEN bytes at SRC into DST, which must come out
+   to exactly DST_LEN bytes.  Returns false if SRC is malformed. */
+static bool
+lz_decompress (const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len)
+{
+  size_t ip = 0, op = 0;
+
+  while (ip < len)
+    {
+      uint8_t token = src[ip++];
+      size_t lit_len = token >> 4;
+      size_t match_len = token & 15;
+      size_t offset;
+
+      if (lit_len == 15 && !get_length (src, &ip, len, &lit_len))
+        return false;
+      if (len - ip < lit_len || dst_len - op < lit_len)
+        return false;
+      memcpy (dst + op, src + ip, lit_len);
+      ip += lit_len;
+      op += lit_len;
+      if (ip == len)
+        break;
+
+      if (len - ip < 2)
+        return false;
+      offset = src[ip] | src[ip + 1] << 8;
+      ip += 2;
+      if (match_len == 15 && !get_length (src, &ip, len, &match_len))
+        return false;
+      match_len += MIN_MATCH;
+      if (offset == 0 || offset > op || dst_len - op < match_len)
+        return false;
+
+      /* Byte by byte, since the match may overlap its own output. */
+      for (; match_len > 0; match_len--, op++)
+        dst[op] = dst[op - offset];
+    }
+  return op == dst_len;
+}